@@ -63,6 +63,7 @@
  * SPI Flash Configuration
  -----------------------------------------------------------------------*/
 #define CONFIG_CMD_SF				/* sf read\sf write\sf erase */
+#define CONFIG_CMD_SFBENCH			/* sfbench */
 #define CONFIG_SPI_FLASH_HISFC350		1
 
 #ifdef CONFIG_SPI_FLASH_HISFC350
@@ -101,6 +102,11 @@
 #define CONFIG_SYS_HZ		(CFG_TIMER_CLK/256)
 #define CFG_HZ			CONFIG_SYS_HZ
 
+/* TIMER1 runs free without divider for hw_udelay/hw_ndelay (board.c) */
+#define CFG_FINE_TIMERBASE	(TIMER0_REG_BASE + 0x20)
+/* enable timer.32bit, free running,mask irq,no divider. */
+#define CFG_FINE_TIMER_CTRL	0x82
+
 /* allow change env */
 #define CONFIG_ENV_OVERWRITE
 /*-----------------------------------------------------------------------
@@ -225,6 +231,10 @@
 #define CONFIG_ETHADDR_TAG		1
 #define CONFIG_ETHADDR_TAG_VAL		0x726d6d73
 
+/* the ds28e10 result of eth_set_hwaddr, see ds28e10_setup_tag */
+#define CONFIG_DS28E10_TAG		1
+#define CONFIG_DS28E10_TAG_VAL		0x64733238
+
 #undef CONFIG_NANDID_TAG
 #undef CONFIG_SPIID_TAG
 
@@ -287,5 +297,6 @@
 #define CONFIG_FIT
 #define CONFIG_IPNC_ENV_OFFSET	0x80000
 #define CONFIG_UPDATE_TFTP
+#define CONFIG_UPDATE_RAMBOOT	/* boot the updated kernel without reset */
 
 #endif	/* __CONFIG_H */
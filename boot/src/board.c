@@ -38,6 +38,8 @@
 #include <asm/io.h>
 #include <asm/sizes.h>
 #include <asm/arch/platform.h>
+#include <miiphy.h>
+#include <asm/setup.h>
 
 static int boot_media = BOOT_MEDIA_UNKNOW;
 
@@ -50,11 +52,85 @@ void show_boot_progress(int progress)
 
 #define COMP_MODE_ENABLE ((unsigned int)0x0000EAEF)
 
-static inline void delay(unsigned long loops)
+#define W1_PIN		6	/* ds28e10 */
+#define PHY_LINK_MS	3000	/* autonegotiation takes about 2~3s */
+#define PHY_IDLE_MS	50	/* without a link partner, as phy_link_time was */
+
+static ulong phy_aneg_start;
+
+static ulong fine_ticks_per_ms;
+
+/* CFG_FINE_TIMERBASE counts down */
+static inline ulong fine_timer_read(void)
+{
+	return ~__raw_readl(CFG_FINE_TIMERBASE + REG_TIMER_VALUE);
+}
+
+/*
+ * Start the free running timer and calibrate it against the udelay
+ * timer, so that it does not matter which clock it is fed by.
+ */
+static void fine_timer_init(void)
+{
+	ulong start, t0;
+
+	__raw_writel(0, CFG_FINE_TIMERBASE + REG_TIMER_CONTROL);
+	__raw_writel(~0, CFG_FINE_TIMERBASE + REG_TIMER_RELOAD);
+	__raw_writel(CFG_FINE_TIMER_CTRL, CFG_FINE_TIMERBASE + REG_TIMER_CONTROL);
+
+	start = get_timer(0);
+	while (get_timer(start) < 1)	/* align to a tick */
+		;
+
+	/*
+	 * Over 10ms and rounded up: the window is a bit short of it, and
+	 * ticks/us would lose a third at 3MHz.
+	 */
+	start = get_timer(0);
+	t0 = fine_timer_read();
+	while (get_timer(start) < CONFIG_SYS_HZ / 100)
+		;
+
+	fine_ticks_per_ms = (fine_timer_read() - t0 + 9) / 10;
+	debug("fine timer: %lu ticks/ms\n", fine_ticks_per_ms);
+}
+
+/*
+ * Busy waits with the resolution of one fine timer tick, for the bit
+ * slots of bit-banged protocols. Use udelay for anything longer than
+ * a few milliseconds.
+ */
+void hw_ndelay(ulong nsec)
 {
-	__asm__ volatile ("1:\n"
-		"subs %0, %1, #1\n"
-		"bne 1b" : "=r" (loops) : "0" (loops));
+	ulong start, ticks;
+
+	if (!fine_ticks_per_ms) {
+		udelay((nsec + 999) / 1000);
+		return;
+	}
+
+	/* in 1/1000 ticks first, without overflowing for the ms */
+	ticks = nsec / 1000 * fine_ticks_per_ms
+		+ ((nsec % 1000) * fine_ticks_per_ms + 999) / 1000;
+	ticks = (ticks + 999) / 1000;
+	start = fine_timer_read();
+	while (fine_timer_read() - start < ticks)
+		;
+}
+
+void hw_udelay(ulong usec)
+{
+	ulong start, ticks;
+
+	if (!fine_ticks_per_ms) {
+		udelay(usec);
+		return;
+	}
+
+	ticks = (usec * fine_ticks_per_ms + 999) / 1000;
+	start = fine_timer_read();
+	while (fine_timer_read() - start < ticks)
+		;
 }
 
 /* get uboot start media. */
@@ -101,15 +177,70 @@ int board_init(void)
 	return 0;
 }
 
+/*
+ * Both the PHY autonegotiation and the ds28e10 authentication take long,
+ * so get autonegotiation going first and authenticate while the link is
+ * coming up. Called once the ethernet device has been registered.
+ */
+int board_eth_setup(void)
+{
+	extern int eth_set_hwaddr(u32 pin);
+	char *devname = miiphy_get_current_dev();
+	unsigned short bmcr;
+
+	if (devname && !miiphy_read(devname, HISFV_PHY_U, PHY_BMCR, &bmcr)) {
+		/* it normally has been negotiating since power on */
+		if (!(bmcr & PHY_BMCR_AUTON))
+			miiphy_write(devname, HISFV_PHY_U, PHY_BMCR,
+				bmcr | PHY_BMCR_AUTON | PHY_BMCR_RST_NEG);
+		phy_aneg_start = get_timer(0);
+	}
+
+	return eth_set_hwaddr(W1_PIN);
+}
+
+/*
+ * Wait for the link, for what is left of PHY_LINK_MS if a link partner
+ * has been heard, autonegotiation is under way then. Without a cable or
+ * a partner it is only PHY_IDLE_MS, not to slow down every boot.
+ */
+int board_eth_wait_link(void)
+{
+	char *devname = miiphy_get_current_dev();
+	ulong tmo = PHY_LINK_MS * (CONFIG_SYS_HZ / 1000);
+	ulong idle = PHY_IDLE_MS * (CONFIG_SYS_HZ / 1000);
+	ulong start = get_timer(0);
+	unsigned short lpa;
+
+	if (!devname || !phy_aneg_start)
+		return 0;
+
+	while (!miiphy_link(devname, HISFV_PHY_U)) {
+		if (get_timer(phy_aneg_start) > tmo)
+			return 0;
+		if (get_timer(start) > idle
+				&& (miiphy_read(devname, HISFV_PHY_U,
+						PHY_ANLPAR, &lpa) || !lpa))
+			return 0;
+		udelay(1000);
+	}
+
+	return 1;
+}
+
 int misc_init_r(void)
 {
+	fine_timer_init();
+
 #ifdef CONFIG_RANDOM_ETHADDR
 	random_init_r();
 #endif
 	setenv("verify", "n");
 
-	extern int eth_set_hwaddr(u32 pin);
-	eth_set_hwaddr(6);
+#ifndef CONFIG_UPDATE_TFTP
+	/* otherwise it is done by update_tftp while the link comes up */
+	board_eth_setup();
+#endif
 
 #ifdef CONFIG_AUTO_UPDATE
 	extern int do_auto_update(void);
@@ -124,6 +255,16 @@ int misc_init_r(void)
 	return 0;
 }
 
+#ifdef CONFIG_DS28E10_TAG
+/* called by do_bootm_linux before the end tag */
+void setup_board_tags(struct tag **in_params)
+{
+	extern void ds28e10_setup_tag(struct tag **params);
+
+	ds28e10_setup_tag(in_params);
+}
+#endif
+
 int dram_init(void)
 {
 	DECLARE_GLOBAL_DATA_PTR;
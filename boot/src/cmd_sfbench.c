@@ -0,0 +1,217 @@
+/* @ . @ *-c-*
+ *
+ * Copyright (c) 2013, Beijing Hanbang Technology, Inc.
+ * Copyright (c) 2013, John Lee <furious_tauren@163.com>
+ *
+ * All rights reserved. No Part of this file may be reproduced,
+ * stored in a retrieval system, or transmitted, in any form,
+ * or by any means, electronic, mechanical, photocopying, recording,
+ * or otherwise, without the prior consent of HanBang, Inc.
+ */
+
+/*
+ * sfbench - SPI flash throughput
+ *
+ * Measures sequential read, erase per sector size, page program and reads
+ * through the memory mapped window over a scratch region of the flash.
+ * Everything in the region is destroyed.
+ */
+
+#include <common.h>
+#include <command.h>
+#include <spi_flash.h>
+#include <div64.h>
+
+#define SFB_PAGE_SIZE	256
+
+extern ulong load_addr;
+
+static const ulong sfb_erase_size[] = {0x1000, 0x8000, 0x10000};
+
+static ulong sfb_us(ulong start)
+{
+	unsigned long long us = get_timer(start);
+
+	us *= 1000000;
+	do_div(us, CONFIG_SYS_HZ);
+	return us ? (ulong)us : 1;
+}
+
+static void sfb_report(const char *name, ulong bytes, ulong us, ulong ops)
+{
+	unsigned long long kbps = bytes;
+
+	kbps *= 1000000;
+	do_div(kbps, us);
+	kbps >>= 10;
+
+	printf("%-16s %8lu bytes %8lu us %5lu.%02lu MB/s",
+			name, bytes, us, (ulong)kbps >> 10,
+			((ulong)kbps & 0x3ff) * 100 >> 10);
+	if (ops)
+		printf(" %6lu us/op", us / ops);
+	puts("\n");
+}
+
+static int sfb_read(struct spi_flash *flash, ulong off, ulong len, u8 *buf)
+{
+	ulong start, i;
+
+	start = get_timer(0);
+	if (flash->read(flash, off, len, buf)) {
+		puts("sfbench: read failed\n");
+		return 1;
+	}
+	sfb_report("read", len, sfb_us(start), 1);
+
+	start = get_timer(0);
+	for (i = 0; i < len; i += 0x1000) {
+		if (flash->read(flash, off + i, min(len - i, 0x1000UL), buf + i)) {
+			puts("sfbench: read failed\n");
+			return 1;
+		}
+	}
+	sfb_report("read 4K", len, sfb_us(start), (len + 0xfff) / 0x1000);
+
+	return 0;
+}
+
+static int sfb_mmap(ulong off, ulong len, const u8 *ref, u8 *buf)
+{
+	ulong start;
+
+	start = get_timer(0);
+	memcpy(buf, (void *)(CONFIG_HISFC350_BUFFER_BASE_ADDRESS + off), len);
+	sfb_report("read mmap", len, sfb_us(start), 1);
+
+	if (memcmp(ref, buf, len)) {
+		puts("sfbench: mmap read differs from flash->read\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static void sfb_erase(struct spi_flash *flash, ulong off, ulong len)
+{
+	char name[16];
+	ulong start, i, j;
+
+	for (i = 0; i < ARRAY_SIZE(sfb_erase_size); i++) {
+		ulong sz = sfb_erase_size[i];
+
+		if (len < sz || off % sz)
+			continue;
+
+		sprintf(name, "erase %luK", sz >> 10);
+		start = get_timer(0);
+		for (j = 0; j + sz <= len; j += sz) {
+			if (flash->erase(flash, off + j, sz))
+				break;
+		}
+
+		if (j + sz <= len)
+			printf("%-16s not supported\n", name);
+		else
+			sfb_report(name, j, sfb_us(start), j / sz);
+	}
+}
+
+static int sfb_program(struct spi_flash *flash, ulong off, ulong len, u8 *buf)
+{
+	ulong start, i;
+
+	if (flash->erase(flash, off, len)) {
+		puts("sfbench: erase failed\n");
+		return 1;
+	}
+
+	start = get_timer(0);
+	for (i = 0; i < len; i += SFB_PAGE_SIZE) {
+		if (flash->write(flash, off + i, SFB_PAGE_SIZE, buf + i)) {
+			puts("sfbench: page program failed\n");
+			return 1;
+		}
+	}
+	sfb_report("page program", len, sfb_us(start), len / SFB_PAGE_SIZE);
+
+	if (flash->erase(flash, off, len)) {
+		puts("sfbench: erase failed\n");
+		return 1;
+	}
+
+	start = get_timer(0);
+	if (flash->write(flash, off, len, buf)) {
+		puts("sfbench: write failed\n");
+		return 1;
+	}
+	sfb_report("write", len, sfb_us(start), 1);
+
+	return 0;
+}
+
+static int do_sfbench(cmd_tbl_t *cmdtp, int flag, int argc, char *argv[])
+{
+	struct spi_flash *flash;
+	unsigned int speed = 1000000;
+	unsigned int mode = 0x3;
+	ulong off, len, i;
+	u8 *buf, *ref;
+
+	if (argc < 3)
+		return cmd_usage(cmdtp);
+
+	off = simple_strtoul(argv[1], NULL, 16);
+	len = simple_strtoul(argv[2], NULL, 16);
+	if (argc > 3)
+		speed = simple_strtoul(argv[3], NULL, 10);
+	if (argc > 4)
+		mode = simple_strtoul(argv[4], NULL, 16);
+
+	if (!len || off % 0x10000 || len % 0x10000) {
+		puts("sfbench: offset and len must be 64K aligned\n");
+		return 1;
+	}
+
+	flash = spi_flash_probe(0, 0, speed, mode);
+	if (!flash) {
+		puts("Failed to initialize SPI flash\n");
+		return 1;
+	}
+
+	if (off + len > flash->size) {
+		puts("sfbench: region is out of flash\n");
+		return 1;
+	}
+
+	/* two buffers: the pattern and the read back */
+	ref = (u8 *)load_addr;
+	buf = ref + len;
+	for (i = 0; i < len; i++)
+		ref[i] = i ^ (i >> 8);
+
+	printf("%s: %u Hz, mode 0x%x, 0x%08lx+0x%lx\n",
+			flash->name, speed, mode, off, len);
+
+	sfb_erase(flash, off, len);
+	if (sfb_program(flash, off, len, ref))
+		return 1;
+	if (sfb_read(flash, off, len, buf))
+		return 1;
+
+	if (memcmp(ref, buf, len)) {
+		puts("sfbench: read back differs from what was written\n");
+		return 1;
+	}
+
+	return sfb_mmap(off, len, ref, buf);
+}
+
+U_BOOT_CMD(
+	sfbench, 5, 0, do_sfbench,
+	"SPI flash read/erase/program throughput",
+	"offset len [speed [mode]]\n"
+	"    - measure throughput over the 64K aligned scratch region\n"
+	"      offset+len (hex), all data in it is destroyed.\n"
+	"      data buffers are at $loadaddr, 2*len bytes"
+);
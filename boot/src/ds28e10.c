@@ -12,9 +12,45 @@
 #include <common.h>
 #include <config.h>
 #include <asm/io.h>
+#include <asm/setup.h>
 
 #define W1_PIN			6
 #define DS28E10_RETRY_CN	3
+#define DS28E10_OVERDRIVE	1
+
+/*
+ * Slots are timed by the undivided timer in board.c, udelay ticks
+ * at CFG_TIMER_CLK/256 here and is too coarse for them.
+ */
+extern void hw_ndelay(unsigned long nsec);
+
+/* in ns, see the waveforms in ds28e10_read_bit/write_bit/reset */
+struct w1_timing {
+	u32 rstl, msp, rsth;
+	u32 rl, msr, rrec;
+	u32 w1l, w1rec;
+	u32 w0l, w0rec;
+};
+
+static const struct w1_timing w1_std = {
+	480000, 70000, 410000,
+	6000, 9000, 55000,
+	6000, 64000,
+	60000, 10000,
+};
+
+/*
+ * tMSR is 2us at most at overdrive, tRL and the register accesses
+ * already take most of it, the sample follows the release at once.
+ */
+static const struct w1_timing w1_od = {
+	70000, 8000, 40000,
+	1000, 0, 9000,
+	1000, 9000,
+	8000, 2000,
+};
+
+static const struct w1_timing *w1_t = &w1_std;
 
 struct authentication_data {
 	u8 challenge[12];
@@ -22,6 +58,22 @@ struct authentication_data {
 	u8 mac[22];
 };
 
+#ifdef CONFIG_DS28E10_TAG
+/*
+ * What eth_set_hwaddr found, passed to linux so that it need not ask the
+ * chip again. Keep it the same as struct tag_ds28e10 in the kernel.
+ */
+struct tag_ds28e10 {
+	s32 status;	/* 0: authenticated */
+	u8 romid[8];	/* valid if romid_ok */
+	u8 otp[4];	/* valid if status is 0 */
+	u32 romid_ok;
+};
+
+static struct tag_ds28e10 ds28e10_result;
+static int ds28e10_result_valid;
+#endif
+
 static u8 w1_crc8_table[] = {
 	0, 94, 188, 226, 97, 63, 221, 131, 194, 156, 126, 32,
 	163, 253, 31, 65, 157, 195, 33, 127, 252, 162, 64, 30,
@@ -140,13 +192,14 @@ static u8 ds28e10_read_bit(u8 pin)
 	 * tF\_tRL_/....................\__
 	 */
 	ds28e10_master_pulldown(pin);
-	udelay(6);
+	hw_ndelay(w1_t->rl);
 
 	ds28e10_master_release(pin);
-	udelay(9);
+	if (w1_t->msr)
+		hw_ndelay(w1_t->msr);
 
 	result = ds28e10_master_sample(pin);
-	udelay(55);
+	hw_ndelay(w1_t->rrec);
 
 	return result;
 }
@@ -161,14 +214,14 @@ static void ds28e10_write_bit(u8 pin, int bit)
 	 */
 	if (bit) {
 		ds28e10_master_pulldown(pin);
-		udelay(6);
+		hw_ndelay(w1_t->w1l);
 		ds28e10_master_release(pin);
-		udelay(64);
+		hw_ndelay(w1_t->w1rec);
 	} else {
 		ds28e10_master_pulldown(pin);
-		udelay(60);
+		hw_ndelay(w1_t->w0l);
 		ds28e10_master_release(pin);
-		udelay(10);
+		hw_ndelay(w1_t->w0rec);
 	}
 }
 
@@ -182,13 +235,13 @@ static int ds28e10_reset(u32 pin)
 	 *                         tMSR
 	 */
 	ds28e10_master_pulldown(pin);
-	udelay(480);
+	hw_ndelay(w1_t->rstl);
 
 	ds28e10_master_release(pin);
-	udelay(70);
+	hw_ndelay(w1_t->msp);
 
 	result = ds28e10_master_sample(pin);
-	udelay(410);
+	hw_ndelay(w1_t->rsth);
 
 	ds28e10_master_release(pin);
 	return result;
@@ -234,15 +287,31 @@ static u32 ds28e10_write_block(u32 pin, const u8 *buf, u32 len)
 	return len;
 }
 
-static int ds28e10_reset_slave(u32 pin)
+/*
+ * Reset and skip the romid. With od set, the first call sends
+ * overdrive-skip-rom at standard speed and both sides stay at
+ * overdrive until a reset at standard speed.
+ */
+static int ds28e10_reset_slave(u32 pin, int od)
 {
 	int rval;
 
+	if (!od)
+		w1_t = &w1_std;
+
 	rval = ds28e10_reset(pin);
-	if (rval)
+	if (rval) {
+		w1_t = &w1_std;
 		return rval;
+	}
 
-	ds28e10_write_8(pin, 0xcc);
+	if (!od || w1_t == &w1_od) {
+		ds28e10_write_8(pin, 0xcc);
+		return 0;
+	}
+
+	ds28e10_write_8(pin, 0x3c);
+	w1_t = &w1_od;
 	return 0;
 }
 
@@ -252,6 +321,7 @@ static int ds28e10_read_romid(u32 pin, u8 id[8])
 	int rval;
 
 	do {
+		w1_t = &w1_std;	/* there is no overdrive read-rom */
 		rval = ds28e10_reset(pin);
 		if (rval)
 			continue;
@@ -264,12 +334,12 @@ static int ds28e10_read_romid(u32 pin, u8 id[8])
 	return rval;
 }
 
-static int ds28e10_write_challenge(u32 pin, u8 *buf)
+static int ds28e10_write_challenge(u32 pin, u8 *buf, int od)
 {
 	int rval;
 	u8 challenge[12];
 
-	rval = ds28e10_reset_slave(pin);
+	rval = ds28e10_reset_slave(pin, od);
 	if (rval)
 		return rval;
 
@@ -287,14 +357,19 @@ static int ds28e10_read_mac(u32 pin, struct authentication_data *pdata)
 	u8 buf[34] = {0};
 	int rval;
 	int try = 0;
+	int od = DS28E10_OVERDRIVE;
 
 	do {
-		rval = ds28e10_write_challenge(pin, pdata->challenge);
+		/* fall back to standard speed once anything goes wrong */
+		if (try)
+			od = 0;
+
+		rval = ds28e10_write_challenge(pin, pdata->challenge, od);
 		if (rval)
 			continue;
 
 		/* reset device to read authentication page */
-		rval = ds28e10_reset_slave(pin);
+		rval = ds28e10_reset_slave(pin, od);
 		if (rval)
 			continue;
 
@@ -322,6 +397,11 @@ static int ds28e10_read_mac(u32 pin, struct authentication_data *pdata)
 			rval = -222;
 	} while (rval && ++try < DS28E10_RETRY_CN);
 
+	if (w1_t != &w1_std) {	/* back to standard speed for the kernel */
+		w1_t = &w1_std;
+		ds28e10_reset(pin);
+	}
+
 	return rval;
 }
 
@@ -330,7 +410,7 @@ static int ds28e10_soft_reset(u32 pin)
 	u8 buf[20] = {0x55, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff};
 
 
-	ds28e10_reset_slave(pin);
+	ds28e10_reset_slave(pin, 0);
 	ds28e10_write_block(pin, buf, 7);
 	ds28e10_read_block(pin, &buf[7], 2);
 	if (crc16(0, buf, 9) != 0xb001)
@@ -464,6 +544,11 @@ static int authenticate(u32 pin, struct authentication_data *pdata, u8 *otp)
 		return rval;
 	}
 
+#ifdef CONFIG_DS28E10_TAG
+	memcpy(ds28e10_result.romid, romid, 8);
+	ds28e10_result.romid_ok = 1;
+#endif
+
 	generate_secret(romid, secret);
 
 	rval = ds28e10_read_mac(pin, pdata);
@@ -524,6 +609,13 @@ int eth_set_hwaddr(u32 pin)
 		memcpy(&p[2], sn, 4);
 
 _out:
+#ifdef CONFIG_DS28E10_TAG
+	ds28e10_result.status = rval;
+	if (!rval)
+		memcpy(ds28e10_result.otp, sn, 4);
+	ds28e10_result_valid = 1;
+#endif
+
 	/* check and configure hwaddr */
        	sprintf(ethaddr, "%02X:%02X:%02X:%02X:%02X:%02X",
 		       	p[0], p[1], p[2], p[3], p[4], p[5]);
@@ -531,3 +623,20 @@ _out:
 	setenv ("ethaddr", ethaddr);
 	return rval;
 }
+
+#ifdef CONFIG_DS28E10_TAG
+void ds28e10_setup_tag(struct tag **params)
+{
+	struct tag *t = *params;
+
+	if (!ds28e10_result_valid)
+		return;
+
+	t->hdr.tag = CONFIG_DS28E10_TAG_VAL;
+	t->hdr.size = (sizeof(struct tag_header)
+			+ sizeof(struct tag_ds28e10) + 3) >> 2;
+	memcpy(&t->u, &ds28e10_result, sizeof(struct tag_ds28e10));
+
+	*params = tag_next(t);
+}
+#endif
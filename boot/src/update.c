@@ -34,6 +34,8 @@ extern ulong TftpRRQTimeoutMSecs;
 extern int TftpRRQTimeoutCountMax;
 extern ulong load_addr;
 extern int do_reset (cmd_tbl_t *cmdtp, int flag, int argc, char *argv[]);
+extern int board_eth_setup(void);
+extern int board_eth_wait_link(void);
 
 struct part_info {
 
@@ -100,7 +102,11 @@ static int update_load(char *filename, ulong msec_max, void *addr)
 	TftpRRQTimeoutMSecs = msec_max;
 	TftpRRQTimeoutCountMax = 0; /* no retry */
 
-	/*XXX: to reduce net link wait time */
+	/*
+	 * XXX: to reduce net link wait time. board_eth_setup has got
+	 * autonegotiation going, wait for the rest of it here.
+	 */
+	board_eth_wait_link();
 	setenv("phy_link_time", "50");
 
 	/* we don't want to retry the connection if errors occur */
@@ -331,26 +337,94 @@ __next_node:
 	return 1;
 }
 
+static const char *part_name[PART_NUM] = {
+	"u-boot", "kernel", "rootfs", "appfs"
+};
+
+/* Map an image node to its slot in ph by its description */
+static int update_part_index(const void *fit, int noffset)
+{
+	char *desc;
+	int i;
+
+	if (fit_get_desc(fit, noffset, &desc))
+		return -1;
+
+	for (i = 0; i < PART_NUM; i++)
+		if (!strcmp(part_name[i], desc))
+			return i;
+
+	return -1;
+}
+
+/*
+ * A partial firmware (see pub/bin/mkpartial.sh) only carries the images
+ * which changed since the baseline release. The partitions it leaves out
+ * are kept as they are, so they must already have a valid record in ph,
+ * with the md5 the baseline node of the firmware gives for them. A device
+ * on another release needs a full firmware.
+ */
+static int update_check_partial(const void *fit)
+{
+	int noffset, ndepth = 0;
+	int found[PART_NUM] = {0};
+	const void *md5;
+	int i, base, len;
+
+	if (!fdt_getprop(fit, 0, "partial", NULL))
+		return 0;
+
+	noffset = fdt_path_offset(fit, FIT_IMAGES_PATH);
+	noffset = fdt_next_node(fit, noffset, &ndepth);
+	while (noffset >= 0 && ndepth > 0) {
+		if (ndepth == 1) {
+			i = update_part_index(fit, noffset);
+			if (i >= 0)
+				found[i] = 1;
+		}
+		noffset = fdt_next_node(fit, noffset, &ndepth);
+	}
+
+	base = fdt_path_offset(fit, "/baseline");
+	if (base < 0) {
+		puts("Partial firmware without a baseline, ignored\n");
+		return 1;
+	}
+
+	puts("Partial firmware, untouched partitions are kept\n");
+	for (i = 0; i < PART_NUM; i++) {
+		if (found[i])
+			continue;
+
+		md5 = fdt_getprop(fit, base, part_name[i], &len);
+		if (!md5) {
+			if (i < PART_NUM - 1) /* the same as is_need_update */
+				goto bad;
+			continue;
+		}
+
+		if (len != 16 || ph.fwparts_info[i].magic != FW_MAGIC
+				|| memcmp(md5, ph.fwparts_info[i].md5, 16))
+			goto bad;
+	}
+
+	return 0;
+
+bad:
+	printf("Partition%d is not the one of the baseline release,"
+			" a full firmware is required\n", i);
+	return 1;
+}
+
 static void update_save_part_head(const void *fit,
 	       	int noffset, ulong start, size_t size)
 {
-	char *part_name[PART_NUM] = {
-		"u-boot", "kernel", "rootfs", "appfs"
-	};
-	char **desc = NULL;
 	uint8_t *md5;
-	int i = 0;
+	int i;
 
-	if (fit_get_desc(fit, noffset, desc)) {
-		puts("Failed to get fit desc, error when update.\n");
+	i = update_part_index(fit, noffset);
+	if (i < 0)
 		return;
-	}
-
-	while (strcmp(part_name[i], *desc)) {
-		if (i >= PART_NUM)
-			return;
-		i++;
-	}
 
 	if (update_fit_get_hash(fit, noffset, &md5)) {
 		puts("Failed to get part hash, error when update.\n");
@@ -364,6 +438,32 @@ static void update_save_part_head(const void *fit,
 	memcpy(ph.fwparts_info[i].md5, (const char *)md5, 16);
 }
 
+#ifdef CONFIG_UPDATE_RAMBOOT
+/*
+ * The kernel we have just flashed is still in the FIT at LOADADDR and its
+ * hash has been checked, so boot it from there instead of resetting and
+ * reading back and verifying all the partitions again.
+ */
+static void update_boot_ram(const void *kernel)
+{
+	char *verify = getenv("verify");
+	char cmd[32];
+
+	if (verify)
+		verify = strdup(verify);
+
+	printf("Booting the updated kernel from 0x%08lx\n", (ulong)kernel);
+	setenv("verify", "n");
+	sprintf(cmd, "bootm 0x%08lx", (ulong)kernel);
+	run_command(cmd, 0);
+
+	setenv("verify", verify);
+	if (verify)
+		free(verify);
+	puts("Failed to boot from RAM, resetting\n");
+}
+#endif
+
 void update_tftp(void)
 {
 	int noffset, ndepth = 0;
@@ -371,8 +471,13 @@ void update_tftp(void)
 	ulong fladdr, entry;
        	size_t size;
 	void *fit = LOADADDR;
+	const void *kernel = NULL;
+	int failed = 0;
 	char filename[32];
 
+	/* authenticate and set ethaddr while the PHY link comes up */
+	board_eth_setup();
+
 	if (!get_firmware_filename((char *)fit, filename))
 		return;
 
@@ -392,6 +497,11 @@ void update_tftp(void)
 		return;
 	}
 
+	if (update_check_partial(fit)) {
+		printf("Unusable partial firmware, aborting auto-update\n");
+		return;
+	}
+
 	noffset = fdt_path_offset(fit, FIT_IMAGES_PATH);
 	noffset = fdt_next_node(fit, noffset, &ndepth);
 	while (noffset >= 0 && ndepth > 0) {
@@ -401,6 +511,9 @@ void update_tftp(void)
 
 		printf("\nUpdating '%s': ", fit_get_name(fit, noffset, NULL));
 
+		/* any failure: reset, so that the update is tried again */
+		failed++;
+
 		if (!fit_image_check_hashes(fit, noffset))
 			goto next_node;
 		printf("\n");
@@ -423,7 +536,11 @@ void update_tftp(void)
 		if (update_flash(data, fladdr, size, entry))
 			goto next_node;
 
+		failed--;
+
 		update_save_part_head(fit, noffset, fladdr, size);
+		if (update_part_index(fit, noffset) == 1)
+			kernel = data;
 
 next_node:
 		noffset = fdt_next_node(fit, noffset, &ndepth);
@@ -435,6 +552,11 @@ next_node:
 
 	puts("\n@::::::::::::::::::::::++++::::::::::::::::::::::@\n");
 	printf("Succeeding in updating!\n\n");
+
+#ifdef CONFIG_UPDATE_RAMBOOT
+	if (kernel && !failed)
+		update_boot_ram(kernel);
+#endif
 	do_reset(NULL, 0, 0, NULL);
 }
 
@@ -35,9 +35,22 @@
 #include <linux/mutex.h>
 #include <linux/sysfs.h>
 #include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/bitops.h>
 #include <linux/log2.h>
 #include <linux/i2c.h>
 #include <linux/io.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/crc16.h>
+#include <asm/uaccess.h>
+#include <asm/unaligned.h>
+
+/* the key-value store, the kernel defconfigs have it */
+#if !defined(CONFIG_CRC16) && !defined(CONFIG_CRC16_MODULE)
+#error "24lcx needs CONFIG_CRC16 in the kernel"
+#endif
 
 #define AT24F_ADDR16 (0x1)
 #define AT24F_ADDR11 (0x2)
@@ -48,6 +61,35 @@ struct hb24lcx_platform_data {
 	u8 magic;
 };
 
+struct hb24lcx_write_stats {
+	unsigned long pages;
+	unsigned long polls;	/* address writes not acked */
+	unsigned long timeouts;
+	unsigned long skipped;	/* pages that had the data already */
+	u64 cycle_sum;		/* us from the data to the ack */
+	u32 cycle_max;
+	size_t last_bytes;	/* the last write to the bin file */
+	u32 last_us;
+};
+
+/* see kv_set() */
+#define KV_MAGIC	0x6b
+#define KV_KEYS		256
+#define KV_HDR_LEN	8	/* magic, key, len, 0, seq (le32) */
+#define KV_CRC_LEN	2	/* crc16 of the rest of the page, le16 */
+
+struct hb24lcx_kv_store {
+	unsigned first;		/* page of kv_offset */
+	unsigned npages;
+	unsigned vmax;		/* value bytes in a record */
+	unsigned head;		/* where the next record goes */
+	u32 seq;		/* of the newest record */
+	s16 index[KV_KEYS];	/* page of the key from first, -1: none */
+	u32 kseq[KV_KEYS];
+	unsigned long *live;	/* pages in index */
+	u8 *page;
+};
+
 struct hb24lcx_data {
 	struct hb24lcx_platform_data *chip;
 	struct mutex lock;
@@ -55,6 +97,13 @@ struct hb24lcx_data {
 	u8 *writebuf;
 	unsigned write_max;
 	struct i2c_client *client;
+	struct hb24lcx_write_stats wst;
+	u8 *cache;		/* the whole device, see at24_fill() */
+	int cache_valid;
+	u8 *shadow;		/* write back: what the device has */
+	unsigned long *dirty;	/* pages of cache to write */
+	struct delayed_work flush_work;
+	struct hb24lcx_kv_store *kv;
 };
 
 static unsigned io_limit = 128;
@@ -69,6 +118,30 @@ static unsigned write_timeout = 25;
 module_param(write_timeout, uint, 0);
 MODULE_PARM_DESC(write_timeout, "Time (in ms) to try writes (default 25)");
 
+static unsigned ack_poll_us = 200;
+module_param(ack_poll_us, uint, 0644);
+MODULE_PARM_DESC(ack_poll_us, "Delay between ack polls (default 200us)");
+
+static unsigned read_cache = 1;
+module_param(read_cache, uint, 0);
+MODULE_PARM_DESC(read_cache, "Keep a copy of the device in RAM (default 1)");
+
+static unsigned write_back = 0;
+module_param(write_back, uint, 0);
+MODULE_PARM_DESC(write_back, "Write to the device later (default 0)");
+
+static unsigned flush_ms = 1000;
+module_param(flush_ms, uint, 0644);
+MODULE_PARM_DESC(flush_ms, "Write back this long after a write (default 1000)");
+
+static unsigned kv_offset = 0;
+module_param(kv_offset, uint, 0);
+MODULE_PARM_DESC(kv_offset, "Offset of the key-value store, page aligned");
+
+static unsigned kv_pages = 0;
+module_param(kv_pages, uint, 0);
+MODULE_PARM_DESC(kv_pages, "Pages of the key-value store (default 0, none)");
+
 static const struct i2c_device_id hb24lcx_ids[] = {
 	{"24lcx", 0},
 	{ /* END OF LIST */ }
@@ -76,17 +149,14 @@ static const struct i2c_device_id hb24lcx_ids[] = {
 
 MODULE_DEVICE_TABLE(i2c, hb24lcx_ids);
 
-static ssize_t __read(struct hb24lcx_data *pdata, char *buf,
-		      unsigned offset, size_t count)
+static ssize_t __read_seq(struct hb24lcx_data *pdata, char *buf,
+			  unsigned offset, size_t count)
 {
 	struct i2c_msg msg[2];
 	unsigned long timeout, read_time;
 	struct i2c_client *client = pdata->client;
 	u8 msgbuf[2];
 
-	if (count > io_limit)
-		count = io_limit;
-
 	memset(msg, 0, sizeof(msg));
 
 	msgbuf[0] = offset >> 8;
@@ -119,15 +189,58 @@ static ssize_t __read(struct hb24lcx_data *pdata, char *buf,
 	return -ETIMEDOUT;
 }
 
-static ssize_t at24_read(struct hb24lcx_data *pdata,
-			 char *buf, loff_t off, size_t count)
+static ssize_t __read(struct hb24lcx_data *pdata, char *buf,
+		      unsigned offset, size_t count)
+{
+	if (count > io_limit)
+		count = io_limit;
+
+	return __read_seq(pdata, buf, offset, count);
+}
+
+/*
+ * Read the whole device into the cache, in one sequential read. The
+ * 24LC16 is eight devices of 256 bytes, one read each then.
+ */
+static int at24_fill(struct hb24lcx_data *pdata)
+{
+	unsigned size = pdata->chip->byte_len;
+	unsigned off, count;
+	ssize_t status;
+
+	pdata->cache_valid = 0;
+
+	for (off = 0; off < size; off += count) {
+		count = size - off;
+		if (pdata->chip->magic & AT24F_ADDR11)
+			count = min(count, 256 - (off & 0xff));
+
+		status = __read_seq(pdata, pdata->cache + off, off, count);
+		if (status != count)
+			return status < 0 ? status : -EIO;
+	}
+
+	if (pdata->shadow) {
+		memcpy(pdata->shadow, pdata->cache, size);
+		bitmap_zero(pdata->dirty, size / pdata->chip->page_size);
+	}
+
+	pdata->cache_valid = 1;
+	return 0;
+}
+
+/* the caller holds pdata->lock */
+static ssize_t __at24_read(struct hb24lcx_data *pdata,
+			   char *buf, loff_t off, size_t count)
 {
 	ssize_t retval = 0;
 
-	if (unlikely(!count))
+	if (pdata->cache && (pdata->cache_valid || !at24_fill(pdata))) {
+		memcpy(buf, pdata->cache + off, count);
 		return count;
+	}
 
-	mutex_lock(&pdata->lock);
+	/* the fill failed, try the old way */
 	while (count) {
 		ssize_t status;
 
@@ -142,6 +255,20 @@ static ssize_t at24_read(struct hb24lcx_data *pdata,
 		count -= status;
 		retval += status;
 	}
+
+	return retval;
+}
+
+static ssize_t at24_read(struct hb24lcx_data *pdata,
+			 char *buf, loff_t off, size_t count)
+{
+	ssize_t retval;
+
+	if (unlikely(!count))
+		return count;
+
+	mutex_lock(&pdata->lock);
+	retval = __at24_read(pdata, buf, off, count);
 	mutex_unlock(&pdata->lock);
 
 	return retval;
@@ -157,6 +284,63 @@ static ssize_t at24_bin_read(struct file *filp, struct kobject *kobj,
 	return at24_read(pdata, buf, off, count);
 }
 
+/*
+ * The device does not ack its address until the write cycle is over, 5
+ * ms at most for the 24LC32 but often less. Poll for it with zero length
+ * writes instead of sleeping for the worst case. Without high resolution
+ * timers usleep_range sleeps for whole jiffies, the cycle is mostly over
+ * after the first of them then, but the CPU is not spun meanwhile.
+ */
+static int __write_wait(struct hb24lcx_data *pdata, u16 addr)
+{
+	struct i2c_client *client = pdata->client;
+	struct i2c_msg msg;
+	unsigned long timeout, poll_time;
+	ktime_t start = ktime_get();
+	u32 us;
+
+	msg.addr = addr;
+	msg.flags = 0;
+	msg.buf = pdata->writebuf;
+	msg.len = 0;
+
+	timeout = jiffies + msecs_to_jiffies(write_timeout);
+	do {
+		poll_time = jiffies;
+		usleep_range(ack_poll_us, ack_poll_us + ack_poll_us / 4);
+		if (1 == i2c_transfer(client->adapter, &msg, 1)) {
+			us = ktime_to_us(ktime_sub(ktime_get(), start));
+			pdata->wst.cycle_sum += us;
+			pdata->wst.cycle_max = max(pdata->wst.cycle_max, us);
+			return 0;
+		}
+		pdata->wst.polls++;
+	} while (time_before(poll_time, timeout));
+
+	pdata->wst.timeouts++;
+	return -ETIMEDOUT;
+}
+
+/*
+ * Who knows what is in the page after a failed write, write it again at
+ * the next flush, or read it again.
+ */
+static void __write_lost(struct hb24lcx_data *pdata, u8 *dev,
+			 const char *buf, unsigned offset, size_t count)
+{
+	int i;
+
+	if (!dev)
+		return;
+
+	if (pdata->shadow) {
+		for (i = 0; i < count; i++)
+			dev[offset + i] = ~buf[i];
+	} else {
+		pdata->cache_valid = 0;
+	}
+}
+
 static ssize_t __write(struct hb24lcx_data *pdata,
 		       const char *buf, unsigned offset, size_t count)
 {
@@ -164,6 +348,7 @@ static ssize_t __write(struct hb24lcx_data *pdata,
 	unsigned long timeout, write_time;
 	unsigned next_page;
 	struct i2c_client *client = pdata->client;
+	u8 *dev = NULL;
 
 	if (count > pdata->write_max)
 		count = pdata->write_max;
@@ -173,6 +358,15 @@ static ssize_t __write(struct hb24lcx_data *pdata,
 	if (offset + count > next_page)
 		count = next_page - offset;
 
+	/* what the device has, if we know it */
+	if (pdata->cache_valid)
+		dev = pdata->shadow ? pdata->shadow : pdata->cache;
+
+	if (dev && !memcmp(dev + offset, buf, count)) {
+		pdata->wst.skipped++;
+		return count;
+	}
+
 	pdata->writebuf[0] = offset >> 8;
 	pdata->writebuf[1] = offset;
 
@@ -195,31 +389,140 @@ static ssize_t __write(struct hb24lcx_data *pdata,
 		write_time = jiffies;
 
 		if (1 == i2c_transfer(client->adapter, &msg, 1)) {
-
-			/*
-			 * msleep could wastes a lots of time. usleep_range
-			 * is nicer, but it is not always supported by default.
-			 */
-			/* usleep_range(5000, 5000); */
-			msleep(5);
+			pdata->wst.pages++;
+			if (dev)
+				memmove(dev + offset, buf, count);
+			/* a write around the write back, see kv_set() */
+			if (dev && dev != pdata->cache)
+				memmove(pdata->cache + offset, buf, count);
+			if (__write_wait(pdata, msg.addr)) {
+				__write_lost(pdata, dev, buf, offset, count);
+				return -ETIMEDOUT;
+			}
 			return count;
 		}
 
 		msleep(1);
 	} while (time_before(write_time, timeout));
 
+	/* a NACK in the data may have left some of it written */
+	__write_lost(pdata, dev, buf, offset, count);
 	return -ETIMEDOUT;
 }
 
+/*
+ * Write back: the writes only go to the cache, and the pages that differ
+ * from the device are written flush_ms after the first of them, or at a
+ * write to the sync attribute. Only the bytes of a page from the first
+ * to the last that changed are written.
+ */
+static int at24_flush(struct hb24lcx_data *pdata)
+{
+	unsigned ps = pdata->chip->page_size;
+	unsigned npages = pdata->chip->byte_len / ps;
+	unsigned page, first, last;
+	ssize_t status = 0;
+	int err = 0;
+
+	for_each_set_bit(page, pdata->dirty, npages) {
+		u8 *cache = pdata->cache + page * ps;
+		u8 *dev = pdata->shadow + page * ps;
+
+		first = 0;
+		while (first < ps && cache[first] == dev[first])
+			first++;
+		last = ps;
+		while (last > first && cache[last - 1] == dev[last - 1])
+			last--;
+
+		while (first < last) {
+			status = __write(pdata, cache + first,
+					 page * ps + first, last - first);
+			if (status <= 0)
+				break;
+			first += status;
+		}
+
+		if (first < last) {
+			err = status < 0 ? status : -EIO;
+			continue;
+		}
+		clear_bit(page, pdata->dirty);
+	}
+
+	if (err) {
+		dev_err(&pdata->client->dev, "write back failed (%d)\n", err);
+		schedule_delayed_work(&pdata->flush_work,
+				      msecs_to_jiffies(flush_ms));
+	}
+
+	return err;
+}
+
+static void at24_flush_work(struct work_struct *work)
+{
+	struct hb24lcx_data *pdata = container_of(work, struct hb24lcx_data,
+						  flush_work.work);
+
+	mutex_lock(&pdata->lock);
+	at24_flush(pdata);
+	mutex_unlock(&pdata->lock);
+}
+
+static void at24_write_back(struct hb24lcx_data *pdata,
+			    const char *buf, unsigned off, size_t count)
+{
+	unsigned ps = pdata->chip->page_size;
+	unsigned npages = pdata->chip->byte_len / ps;
+	unsigned page;
+
+	memcpy(pdata->cache + off, buf, count);
+
+	for (page = off / ps; page <= (off + count - 1) / ps; page++) {
+		if (memcmp(pdata->cache + page * ps,
+			   pdata->shadow + page * ps, ps))
+			set_bit(page, pdata->dirty);
+		else
+			clear_bit(page, pdata->dirty);
+	}
+
+	/* from the first write, not pushed back by the later ones */
+	if (find_first_bit(pdata->dirty, npages) < npages)
+		schedule_delayed_work(&pdata->flush_work,
+				      msecs_to_jiffies(flush_ms));
+}
+
+/* the records are only written by kv_set(), with pdata->lock held */
+static int at24_in_kv(struct hb24lcx_data *pdata, loff_t off, size_t count)
+{
+	struct hb24lcx_kv_store *kv = pdata->kv;
+	unsigned ps = pdata->chip->page_size;
+
+	return kv && off < (kv->first + kv->npages) * ps
+		&& off + count > kv->first * ps;
+}
+
 static ssize_t at24_write(struct hb24lcx_data *pdata,
 			  const char *buf, loff_t off, size_t count)
 {
 	ssize_t retval = 0;
+	ktime_t start;
 
 	if (unlikely(!count))
 		return count;
 
 	mutex_lock(&pdata->lock);
+	start = ktime_get();
+	if (at24_in_kv(pdata, off, count)) {
+		retval = -EPERM;
+		goto out;
+	}
+	if (pdata->shadow && (pdata->cache_valid || !at24_fill(pdata))) {
+		at24_write_back(pdata, buf, off, count);
+		retval = count;
+		goto out;
+	}
+
 	while (count) {
 		ssize_t status;
 
@@ -234,6 +537,9 @@ static ssize_t at24_write(struct hb24lcx_data *pdata,
 		count -= status;
 		retval += status;
 	}
+out:
+	pdata->wst.last_bytes = retval > 0 ? retval : 0;
+	pdata->wst.last_us = ktime_to_us(ktime_sub(ktime_get(), start));
 	mutex_unlock(&pdata->lock);
 
 	return retval;
@@ -249,6 +555,393 @@ static ssize_t at24_bin_write(struct file *filp, struct kobject *kobj,
 	return at24_write(pdata, buf, off, count);
 }
 
+/*
+ * pages polls timeouts cycle_avg cycle_max (us) skipped, then the bytes,
+ * the time (us) and the rate (bytes/s) of the last write. Writing clears
+ * it.
+ */
+static ssize_t write_stats_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct hb24lcx_data *pdata = dev_get_drvdata(dev);
+	struct hb24lcx_write_stats st;
+	u64 avg, rate;
+
+	mutex_lock(&pdata->lock);
+	st = pdata->wst;
+	mutex_unlock(&pdata->lock);
+
+	avg = st.cycle_sum;
+	if (st.pages)
+		do_div(avg, st.pages);
+	rate = (u64)st.last_bytes * USEC_PER_SEC;
+	if (st.last_us)
+		do_div(rate, st.last_us);
+
+	return sprintf(buf, "%lu %lu %lu %llu %u %lu\n%zu %u %llu\n",
+		       st.pages, st.polls, st.timeouts, avg, st.cycle_max,
+		       st.skipped, st.last_bytes, st.last_us, rate);
+}
+
+static ssize_t write_stats_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct hb24lcx_data *pdata = dev_get_drvdata(dev);
+
+	mutex_lock(&pdata->lock);
+	memset(&pdata->wst, 0, sizeof(pdata->wst));
+	mutex_unlock(&pdata->lock);
+
+	return count;
+}
+
+static DEVICE_ATTR(write_stats, S_IRUGO | S_IWUSR,
+		   write_stats_show, write_stats_store);
+
+/* write anything to read the device into the cache again */
+static ssize_t refresh_store(struct device *dev,
+			     struct device_attribute *attr,
+			     const char *buf, size_t count)
+{
+	struct hb24lcx_data *pdata = dev_get_drvdata(dev);
+	int err = 0;
+
+	mutex_lock(&pdata->lock);
+	if (!pdata->cache)
+		err = -ENODEV;
+	else if (pdata->shadow && pdata->cache_valid)
+		err = at24_flush(pdata);	/* keep the writes not done */
+	if (!err)
+		err = at24_fill(pdata);
+	mutex_unlock(&pdata->lock);
+
+	return err ? err : count;
+}
+
+static DEVICE_ATTR(refresh, S_IWUSR, NULL, refresh_store);
+
+/*
+ * write anything to write back now. The bin file has no fsync or close
+ * hook to do it from.
+ */
+static ssize_t sync_store(struct device *dev,
+			  struct device_attribute *attr,
+			  const char *buf, size_t count)
+{
+	struct hb24lcx_data *pdata = dev_get_drvdata(dev);
+	int err = 0;
+
+	mutex_lock(&pdata->lock);
+	if (pdata->shadow && pdata->cache_valid)
+		err = at24_flush(pdata);
+	mutex_unlock(&pdata->lock);
+
+	return err ? err : count;
+}
+
+static DEVICE_ATTR(sync, S_IWUSR, NULL, sync_store);
+
+static struct attribute *hb24lcx_attrs[] = {
+	&dev_attr_write_stats.attr,
+	&dev_attr_refresh.attr,
+	&dev_attr_sync.attr,
+	NULL
+};
+
+static const struct attribute_group hb24lcx_attr_group = {
+	.attrs = hb24lcx_attrs,
+};
+
+/* ----------------------------------------------------------------- */
+/* key-value store */
+/* ----------------------------------------------------------------- */
+
+/*
+ * kv_pages pages from kv_offset hold one record each, a value of up to
+ * page_size - 10 bytes for a key 0-255. The pages are a circular log: a
+ * new record goes to the page after the last one written, skipping the
+ * pages that hold the current record of a key, so the writes are spread
+ * over the pages and an update costs one page write. The old record of
+ * the key stays until its page is reused, a record lost half written is
+ * rejected by its CRC at the next scan and the old one is found again.
+ * kv_pages must be more than the number of keys in use.
+ *
+ * The records are written at once, whether write_back is set or not.
+ * A write to them through the eeprom file fails with -EPERM.
+ */
+#define KV_IOC_MAGIC	'e'
+#define KV_VAL_MAX	64
+
+struct hb24lcx_kv {
+	unsigned char key;
+	unsigned char len;		/* of val */
+	unsigned char val[KV_VAL_MAX];
+};
+
+#define KV_GET		_IOWR(KV_IOC_MAGIC, 1, struct hb24lcx_kv)
+#define KV_SET		_IOW(KV_IOC_MAGIC, 2, struct hb24lcx_kv)
+
+/* the device of /dev/eeprom_kv, set and used under kv_mutex */
+static struct hb24lcx_data *kv_pdata;
+static DEFINE_MUTEX(kv_mutex);
+
+static int kv_page_ok(struct hb24lcx_data *pdata, const u8 *page)
+{
+	struct hb24lcx_kv_store *kv = pdata->kv;
+	unsigned ps = pdata->chip->page_size;
+
+	return page[0] == KV_MAGIC && page[2] <= kv->vmax
+		&& crc16(0, page, ps - KV_CRC_LEN)
+			== get_unaligned_le16(page + ps - KV_CRC_LEN);
+}
+
+/* rebuild the index from the records, with pdata->lock held */
+static int kv_scan(struct hb24lcx_data *pdata)
+{
+	struct hb24lcx_kv_store *kv = pdata->kv;
+	unsigned ps = pdata->chip->page_size;
+	unsigned p, nrec = 0;
+	int newest = -1;
+	ssize_t status;
+	u32 seq;
+	u8 key;
+
+	memset(kv->index, 0xff, sizeof(kv->index));
+	bitmap_zero(kv->live, kv->npages);
+	kv->seq = 0;
+
+	for (p = 0; p < kv->npages; p++) {
+		status = __at24_read(pdata, kv->page, (kv->first + p) * ps, ps);
+		if (status != ps)
+			return status < 0 ? status : -EIO;
+		if (!kv_page_ok(pdata, kv->page))
+			continue;
+
+		key = kv->page[1];
+		seq = get_unaligned_le32(kv->page + 4);
+		nrec++;
+
+		if (kv->index[key] < 0 || seq > kv->kseq[key]) {
+			if (kv->index[key] >= 0)
+				clear_bit(kv->index[key], kv->live);
+			kv->index[key] = p;
+			kv->kseq[key] = seq;
+			set_bit(p, kv->live);
+		}
+		if (newest < 0 || seq > kv->seq) {
+			newest = p;
+			kv->seq = seq;
+		}
+	}
+
+	kv->head = newest < 0 ? 0 : (newest + 1) % kv->npages;
+	dev_info(&pdata->client->dev, "%u pages of records, %d keys\n",
+		 nrec, bitmap_weight(kv->live, kv->npages));
+	return 0;
+}
+
+static int kv_get(struct hb24lcx_data *pdata, struct hb24lcx_kv *rec)
+{
+	struct hb24lcx_kv_store *kv = pdata->kv;
+	unsigned ps = pdata->chip->page_size;
+	ssize_t status;
+	int p = kv->index[rec->key];
+
+	if (p < 0)
+		return -ENOENT;
+
+	status = __at24_read(pdata, kv->page, (kv->first + p) * ps, ps);
+	if (status != ps)
+		return status < 0 ? status : -EIO;
+	if (!kv_page_ok(pdata, kv->page) || kv->page[1] != rec->key)
+		return -EIO;
+
+	rec->len = kv->page[2];
+	memcpy(rec->val, kv->page + KV_HDR_LEN, rec->len);
+	return 0;
+}
+
+static int kv_set(struct hb24lcx_data *pdata, const struct hb24lcx_kv *rec)
+{
+	struct hb24lcx_kv_store *kv = pdata->kv;
+	unsigned ps = pdata->chip->page_size;
+	unsigned i, p = 0, off, done;
+	ssize_t status;
+	u16 crc;
+
+	if (rec->len > kv->vmax)
+		return -EINVAL;
+
+	for (i = 0; i < kv->npages; i++) {
+		p = (kv->head + i) % kv->npages;
+		if (!test_bit(p, kv->live))
+			break;
+	}
+	if (i == kv->npages)
+		return -ENOSPC;
+
+	memset(kv->page, 0xff, ps);
+	kv->page[0] = KV_MAGIC;
+	kv->page[1] = rec->key;
+	kv->page[2] = rec->len;
+	kv->page[3] = 0;
+	put_unaligned_le32(kv->seq + 1, kv->page + 4);
+	memcpy(kv->page + KV_HDR_LEN, rec->val, rec->len);
+	crc = crc16(0, kv->page, ps - KV_CRC_LEN);
+	put_unaligned_le16(crc, kv->page + ps - KV_CRC_LEN);
+
+	/* the next one goes past this page, whatever happens now */
+	kv->head = (p + 1) % kv->npages;
+
+	off = (kv->first + p) * ps;
+	for (done = 0; done < ps; done += status) {
+		status = __write(pdata, kv->page + done, off + done, ps - done);
+		if (status <= 0)
+			return status < 0 ? status : -EIO;
+	}
+
+	kv->seq++;
+	if (kv->index[rec->key] >= 0)
+		clear_bit(kv->index[rec->key], kv->live);
+	kv->index[rec->key] = p;
+	kv->kseq[rec->key] = kv->seq;
+	set_bit(p, kv->live);
+	return 0;
+}
+
+static long kv_ioctl(struct file *fp, u32 cmd, ulong arg)
+{
+	struct hb24lcx_data *pdata;
+	struct hb24lcx_kv rec;
+	int rval = -ENOTTY;
+
+	if (cmd != KV_GET && cmd != KV_SET)
+		return rval;
+	if (copy_from_user(&rec, (void *)arg, sizeof(rec)))
+		return -EFAULT;
+
+	mutex_lock(&kv_mutex);
+	pdata = kv_pdata;
+	if (!pdata) {
+		mutex_unlock(&kv_mutex);
+		return -ENODEV;
+	}
+
+	mutex_lock(&pdata->lock);
+	if (cmd == KV_GET)
+		rval = kv_get(pdata, &rec);
+	else
+		rval = kv_set(pdata, &rec);
+	mutex_unlock(&pdata->lock);
+	mutex_unlock(&kv_mutex);
+
+	if (!rval && cmd == KV_GET && copy_to_user((void *)arg, &rec,
+						   sizeof(rec)))
+		rval = -EFAULT;
+
+	return rval;
+}
+
+static const struct file_operations kv_fops = {
+	.owner = THIS_MODULE,
+	.unlocked_ioctl = kv_ioctl,
+};
+
+static struct miscdevice kv_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "eeprom_kv",
+	.fops = &kv_fops
+};
+
+static void kv_exit(struct hb24lcx_data *pdata)
+{
+	struct hb24lcx_kv_store *kv = pdata->kv;
+
+	if (!kv)
+		return;
+
+	mutex_lock(&kv_mutex);
+	if (kv_pdata == pdata) {
+		misc_deregister(&kv_dev);
+		kv_pdata = NULL;
+	}
+	mutex_unlock(&kv_mutex);
+
+	/* at24_write() looks at it */
+	mutex_lock(&pdata->lock);
+	pdata->kv = NULL;
+	mutex_unlock(&pdata->lock);
+
+	kfree(kv->live);
+	kfree(kv->page);
+	kfree(kv);
+}
+
+/* not being able to keep the store is no reason to fail the probe */
+static void kv_init(struct hb24lcx_data *pdata)
+{
+	struct device *dev = &pdata->client->dev;
+	unsigned ps = pdata->chip->page_size;
+	struct hb24lcx_kv_store *kv;
+	int err;
+
+	if (!kv_pages)
+		return;
+
+	if (kv_offset % ps || kv_pages < 2 || ps <= KV_HDR_LEN + KV_CRC_LEN
+			|| kv_offset + kv_pages * ps > pdata->chip->byte_len) {
+		dev_err(dev, "bad kv_offset/kv_pages, no key-value store\n");
+		return;
+	}
+	mutex_lock(&kv_mutex);
+	if (kv_pdata) {
+		mutex_unlock(&kv_mutex);
+		dev_err(dev, "the key-value store is on another device\n");
+		return;
+	}
+
+	kv = kzalloc(sizeof(*kv), GFP_KERNEL);
+	if (!kv) {
+		mutex_unlock(&kv_mutex);
+		return;
+	}
+	kv->first = kv_offset / ps;
+	kv->npages = kv_pages;
+	kv->vmax = min(ps - KV_HDR_LEN - KV_CRC_LEN, (unsigned)KV_VAL_MAX);
+	kv->live = kzalloc(BITS_TO_LONGS(kv_pages) * sizeof(long),
+			   GFP_KERNEL);
+	kv->page = kmalloc(ps, GFP_KERNEL);
+
+	mutex_lock(&pdata->lock);
+	pdata->kv = kv;
+	mutex_unlock(&pdata->lock);
+	if (!kv->live || !kv->page) {
+		err = -ENOMEM;
+		goto err_free;
+	}
+
+	mutex_lock(&pdata->lock);
+	err = kv_scan(pdata);
+	mutex_unlock(&pdata->lock);
+	if (err)
+		goto err_free;
+
+	kv_pdata = pdata;
+	err = misc_register(&kv_dev);
+	if (err) {
+		kv_pdata = NULL;
+		goto err_free;
+	}
+	mutex_unlock(&kv_mutex);
+	return;
+
+err_free:
+	mutex_unlock(&kv_mutex);
+	dev_err(dev, "no key-value store (%d)\n", err);
+	kv_exit(pdata);
+}
+
 static int __devinit hb24lcx_probe(struct i2c_client *client,
 				   const struct i2c_device_id *id)
 {
@@ -291,21 +984,69 @@ static int __devinit hb24lcx_probe(struct i2c_client *client,
 		return -ENOMEM;
 	}
 
+	/* filled at the first read */
+	if (read_cache) {
+		pdata->cache = kmalloc(chip->byte_len, GFP_KERNEL);
+		if (!pdata->cache)
+			dev_warn(&client->dev, "no memory for the cache\n");
+	}
+
+	INIT_DELAYED_WORK(&pdata->flush_work, at24_flush_work);
+	if (write_back && pdata->cache) {
+		pdata->shadow = kmalloc(chip->byte_len, GFP_KERNEL);
+		pdata->dirty = kzalloc(BITS_TO_LONGS(chip->byte_len /
+				chip->page_size) * sizeof(long), GFP_KERNEL);
+		if (!pdata->shadow || !pdata->dirty) {
+			dev_warn(&client->dev, "no memory to write back\n");
+			kfree(pdata->shadow);
+			kfree(pdata->dirty);
+			pdata->shadow = NULL;
+			pdata->dirty = NULL;
+		}
+	}
+
 	pdata->client = client;
 
 	err = sysfs_create_bin_file(&client->dev.kobj, &pdata->bin);
-	if (err) {
-		kfree(pdata->writebuf);
-		kfree(pdata);
-		return err;
-	}
+	if (err)
+		goto err_free;
 
 	i2c_set_clientdata(client, pdata);
 
+	err = sysfs_create_group(&client->dev.kobj, &hb24lcx_attr_group);
+	if (err) {
+		sysfs_remove_bin_file(&client->dev.kobj, &pdata->bin);
+		goto err_free;
+	}
+
 	dev_info(&client->dev,
 		 "%zu byte %s EEPROM, %s, %u bytes/write\n",
-		 pdata->bin.size, client->name, "writable", pdata->write_max);
+		 pdata->bin.size, client->name,
+		 pdata->shadow ? "write back" : "writable", pdata->write_max);
+
+	kv_init(pdata);
 	return 0;
+
+err_free:
+	kfree(pdata->dirty);
+	kfree(pdata->shadow);
+	kfree(pdata->cache);
+	kfree(pdata->writebuf);
+	kfree(pdata);
+	return err;
+}
+
+/* the writes still in the cache must not be lost */
+static void hb24lcx_shutdown(struct i2c_client *client)
+{
+	struct hb24lcx_data *pdata = i2c_get_clientdata(client);
+
+	cancel_delayed_work_sync(&pdata->flush_work);
+	mutex_lock(&pdata->lock);
+	if (pdata->shadow && pdata->cache_valid)
+		at24_flush(pdata);
+	mutex_unlock(&pdata->lock);
+	cancel_delayed_work_sync(&pdata->flush_work);
 }
 
 static int __devexit hb24lcx_remove(struct i2c_client *client)
@@ -313,8 +1054,15 @@ static int __devexit hb24lcx_remove(struct i2c_client *client)
 	struct hb24lcx_data *pdata;
 
 	pdata = i2c_get_clientdata(client);
+	kv_exit(pdata);
+	sysfs_remove_group(&client->dev.kobj, &hb24lcx_attr_group);
 	sysfs_remove_bin_file(&client->dev.kobj, &pdata->bin);
 
+	hb24lcx_shutdown(client);
+
+	kfree(pdata->dirty);
+	kfree(pdata->shadow);
+	kfree(pdata->cache);
 	kfree(pdata->writebuf);
 	kfree(pdata);
 	return 0;
@@ -327,6 +1075,7 @@ static struct i2c_driver hb24lcx_driver = {
 	},
 	.probe = hb24lcx_probe,
 	.remove = __devexit_p(hb24lcx_remove),
+	.shutdown = hb24lcx_shutdown,
 	.id_table = hb24lcx_ids,
 };
 
@@ -21,6 +21,16 @@
 #include <linux/mutex.h>
 #include <linux/random.h>
 #include <linux/crc16.h>
+#include <linux/ktime.h>
+#include <linux/irqflags.h>
+#include <linux/slab.h>
+#include <linux/poll.h>
+#include <linux/workqueue.h>
+#include <linux/io.h>
+#include <linux/interrupt.h>
+#include <linux/completion.h>
+#include <linux/string.h>
+#include <mach/ds28e10_tag.h>
 
 #define DS28E10			"ds28e10"
 #define DS28E10_RETRY_CN	3
@@ -28,13 +38,67 @@
 #define DS28E10_IOC_MAGIC	'm'
 #define IOCTL_GET_ROMID		_IOR(DS28E10_IOC_MAGIC, 1, int)
 #define IOCTL_GET_MAC		_IOR(DS28E10_IOC_MAGIC, 2, int)
-#define HI35X_IOC_MAXNR		2
+#define IOCTL_SUBMIT_MAC	_IO(DS28E10_IOC_MAGIC, 3)
+#define IOCTL_AUTHENTICATE	_IOR(DS28E10_IOC_MAGIC, 4, int)
+#define IOCTL_GET_BOOT_AUTH	_IOR(DS28E10_IOC_MAGIC, 5, int)
+#define HI35X_IOC_MAXNR		5
 
 static int w1_pin = 6;
 module_param(w1_pin, int, 0);
 MODULE_PARM_DESC(w1_pin, "GPIO used as w1 output");
 
-static spinlock_t w1_lock;
+static int overdrive = 1;
+module_param(overdrive, int, 0644);
+MODULE_PARM_DESC(overdrive, "Talk to ds28e10 at overdrive speed (default 1)");
+
+/*
+ * w1_mutex serializes the transactions, IRQs are only disabled inside the
+ * timing-critical part of each slot. w1_irqoff_max records the longest
+ * such section in ns.
+ */
+static DEFINE_MUTEX(w1_mutex);
+static unsigned long w1_irqoff_max;
+
+/* requests tried at overdrive, and those finished at standard speed */
+static unsigned long w1_od_tries, w1_od_fallbacks;
+
+/* the romid never changes, it is read from the bus once */
+static u8 w1_romid[8];
+static int w1_romid_valid;
+
+struct w1_slot {
+	unsigned long flags;
+	ktime_t start;
+};
+
+/* in us, see the waveforms in w1_gpio_read_bit/write_bit/reset */
+struct w1_timing {
+	unsigned int rstl, msp, rsth;	/* reset */
+	unsigned int rl, msr, rrec;	/* read slot */
+	unsigned int w1l, w1rec;	/* write 1 slot */
+	unsigned int w0l, w0rec;	/* write 0 slot */
+};
+
+static const struct w1_timing w1_std = {
+	.rstl = 480, .msp = 70, .rsth = 410,
+	.rl = 6, .msr = 9, .rrec = 55,
+	.w1l = 6, .w1rec = 64,
+	.w0l = 60, .w0rec = 10,
+};
+
+/*
+ * tMSR is 2us at most at overdrive, udelay(1) and the register accesses
+ * already take most of it, the sample follows the release at once.
+ */
+static const struct w1_timing w1_od = {
+	.rstl = 70, .msp = 8, .rsth = 40,
+	.rl = 1, .msr = 0, .rrec = 9,
+	.w1l = 1, .w1rec = 9,
+	.w0l = 8, .w0rec = 2,
+};
+
+/* the speed both master and slave are at, changed by w1_reset_select */
+static const struct w1_timing *w1_t = &w1_std;
 
 struct ds28e10_mac_data {
 	unsigned char challenge[12];
@@ -42,6 +106,33 @@ struct ds28e10_mac_data {
 	unsigned char mac[22];
 };
 
+/* what IOCTL_AUTHENTICATE returns, the challenge is a random one */
+struct ds28e10_auth_data {
+	unsigned char romid[8];
+	unsigned char challenge[12];
+	unsigned char pagedata[32];
+	unsigned char mac[22];
+};
+
+/*
+ * IOCTL_SUBMIT_MAC queues a MAC computation on ds28e10_wq and returns at
+ * once. The result is then read() as a struct ds28e10_mac_data, poll and
+ * SIGIO (fasync) tell when it is ready. A failed request reads -EIO.
+ */
+struct ds28e10_file {
+	spinlock_t lock;
+	int busy;		/* a request is being processed */
+	int ready;		/* the result has not been read yet */
+	int status;
+	struct ds28e10_mac_data mac;
+
+	struct work_struct work;
+	wait_queue_head_t wait;
+	struct fasync_struct *fasync;
+};
+
+static struct workqueue_struct *ds28e10_wq;
+
 static unsigned char w1_crc8_table[] = {
 	0, 94, 188, 226, 97, 63, 221, 131, 194, 156, 126, 32,
 	163, 253, 31, 65, 157, 195, 33, 127, 252, 162, 64, 30,
@@ -77,23 +168,60 @@ static u8 w1_crc8(unsigned char *data, int len)
 	return crc;
 }
 
+/*
+ * A wait outside of the slots. Without high resolution timers
+ * usleep_range sleeps for whole jiffies, 10ms at least at HZ=100, so it
+ * is a udelay then.
+ */
+static inline void w1_wait_us(unsigned long us)
+{
+#ifdef CONFIG_HIGH_RES_TIMERS
+	usleep_range(us, us + us / 8);
+#else
+	udelay(us);
+#endif
+}
+
+static inline void w1_slot_enter(struct w1_slot *slot)
+{
+	local_irq_save(slot->flags);
+	slot->start = ktime_get();
+}
+
+static inline void w1_slot_leave(struct w1_slot *slot)
+{
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), slot->start));
+
+	local_irq_restore(slot->flags);
+	if (ns > w1_irqoff_max)
+		w1_irqoff_max = ns;
+}
+
+/*
+ * The pin is driven through the his_gpio fast path, gpiolib takes the
+ * lock of the bank and reads the direction back for every change. All
+ * callers have IRQs off, see his_gpio_fast_pulldown.
+ */
+static struct his_gpio_fast w1_fast;
+
 static inline void w1_gpio_pulldown(u32 pin)
 {
-	gpio_direction_output(pin, 0);
+	his_gpio_fast_pulldown(&w1_fast);
 }
 
 static inline void w1_gpio_release(u32 pin)
 {
-	gpio_direction_input(pin);
+	his_gpio_fast_release(&w1_fast);
 }
 
 static inline int w1_gpio_sample(u32 pin)
 {
-	return gpio_get_value(pin);
+	return his_gpio_fast_sample(&w1_fast);
 }
 
 static unsigned char w1_gpio_read_bit(u8 pin)
 {
+	struct w1_slot slot;
 	int val;
 
 	/*
@@ -103,20 +231,27 @@ static unsigned char w1_gpio_read_bit(u8 pin)
 	 * the master generates a start signal by pull the bus down for tRL.
 	 * then release the bus, and sample the bus within tMSR
 	 */
+	w1_slot_enter(&slot);
 	w1_gpio_pulldown(pin);
-	udelay(6);
+	udelay(w1_t->rl);
 
 	w1_gpio_release(pin);
-	udelay(9);
+	if (w1_t->msr)
+		udelay(w1_t->msr);
 
 	val = w1_gpio_sample(pin);
-	udelay(55);
+	w1_slot_leave(&slot);
+
+	/* the recovery may be longer, no need to keep IRQs off */
+	udelay(w1_t->rrec);
 
 	return val;
 }
 
 static void w1_gpio_write_bit(u8 pin, int bit)
 {
+	struct w1_slot slot;
+
 	/*
 	 *  \        /``````````````````\
 	 * tF\_tW1L_/                    \__
@@ -125,30 +260,49 @@ static void w1_gpio_write_bit(u8 pin, int bit)
 	 *
 	 * XXX: the master pulls the bus down for tW1L or tW0L
 	 */
+	w1_slot_enter(&slot);
 	if (bit) {
 		w1_gpio_pulldown(pin);
-		udelay(6);
+		udelay(w1_t->w1l);
 		w1_gpio_release(pin);
-		udelay(64);
+		w1_slot_leave(&slot);
+		udelay(w1_t->w1rec);
 	} else {
 		w1_gpio_pulldown(pin);
-		udelay(60);
+		udelay(w1_t->w0l);
 		w1_gpio_release(pin);
-		udelay(10);
+		w1_slot_leave(&slot);
+		udelay(w1_t->w0rec);
 	}
 }
 
 static int w1_gpio_reset(u32 pin)
 {
+	struct w1_slot slot;
 	int val;
 
 	/*
 	 *  \               /```\XXXXXXXX/`````\
 	 * tF\____tRSTL____/tPDH \XXXXXX/ tREC  \__
 	 *                         tMSR
+	 *
+	 * tRSTL has no upper limit at standard speed, IRQs may come in
+	 * there, but it must not sleep: a parasite powered slave held low
+	 * for jiffies browns out and loses its state. At overdrive speed a
+	 * too long one is taken as a standard reset, so it goes into the
+	 * critical section.
 	 */
-	w1_gpio_pulldown(pin);
-	udelay(480);
+	if (w1_t == &w1_std) {
+		w1_slot_enter(&slot);
+		w1_gpio_pulldown(pin);
+		w1_slot_leave(&slot);
+		udelay(w1_t->rstl);
+		w1_slot_enter(&slot);
+	} else {
+		w1_slot_enter(&slot);
+		w1_gpio_pulldown(pin);
+		udelay(w1_t->rstl);
+	}
 
 	/*
 	 * after tRSTL, Vpup and slave control the bus.
@@ -156,10 +310,15 @@ static int w1_gpio_reset(u32 pin)
 	 * Pulse by pulling the line low for tPDL.
 	 */
 	w1_gpio_release(pin);
-	udelay(70);
+	udelay(w1_t->msp);
 
 	val = w1_gpio_sample(pin);
-	udelay(410);
+	w1_slot_leave(&slot);
+
+	if (w1_t == &w1_std)
+		w1_wait_us(w1_t->rsth);
+	else
+		udelay(w1_t->rsth);
 
 	return val;
 }
@@ -203,10 +362,385 @@ static ssize_t w1_gpio_write_block(u32 pin, const u8 *buf, size_t len)
 	return len;
 }
 
+/*
+ * Time a release and a sample of the idle bus, through gpiolib and
+ * through the fast path. Neither disturbs the slave. Each batch has IRQs
+ * off for a few us only, the fastest batch is taken.
+ */
+#define W1_MEASURE_BATCHES	64
+#define W1_MEASURE_LOOPS	16	/* per batch */
+
+static s64 w1_gpio_measure_one(int fast)
+{
+	unsigned long flags;
+	ktime_t t0, t1;
+	int i;
+
+	local_irq_save(flags);
+	t0 = ktime_get();
+	for (i = 0; i < W1_MEASURE_LOOPS; i++) {
+		if (fast) {
+			his_gpio_fast_release(&w1_fast);
+			his_gpio_fast_sample(&w1_fast);
+		} else {
+			gpio_direction_input(w1_pin);
+			gpio_get_value(w1_pin);
+		}
+	}
+	t1 = ktime_get();
+	local_irq_restore(flags);
+
+	return ktime_to_ns(ktime_sub(t1, t0));
+}
+
+static void w1_gpio_measure(void)
+{
+	s64 ns[2] = { LLONG_MAX, LLONG_MAX };
+	int i, fast;
+
+	gpio_direction_input(w1_pin);
+
+	for (i = 0; i < W1_MEASURE_BATCHES; i++) {
+		for (fast = 0; fast < 2; fast++)
+			ns[fast] = min(ns[fast], w1_gpio_measure_one(fast));
+		cond_resched();
+	}
+
+	pr_info("%s: release+sample %lld ns by gpiolib, %lld ns by fast path\n",
+			DS28E10,
+			div_s64(ns[0], W1_MEASURE_LOOPS),
+			div_s64(ns[1], W1_MEASURE_LOOPS));
+}
+
+static int w1_gpio_init(void)
+{
+	if (!gpio_is_valid(w1_pin)) {
+		pr_err("%s: %d is invalid GPIO port\n", DS28E10, w1_pin);
+		return -EFAULT;
+	}
+
+	if (gpio_request(w1_pin, DS28E10)) {
+		pr_err("%s: %d is used\n", DS28E10, w1_pin);
+		return -EBUSY;
+	}
+
+	if (his_gpio_fast_request(w1_pin, &w1_fast)) {
+		gpio_free(w1_pin);
+		return -EINVAL;
+	}
+
+	w1_gpio_measure();
+	return 0;
+}
+
+static void w1_gpio_exit(void)
+{
+	gpio_free(w1_pin);
+}
+
+/* ---------------------------------------------------------------- */
+/* w1 master by a PL011 uart */
+/* ---------------------------------------------------------------- */
+
+/*
+ * TXD drives the bus through an open drain buffer and RXD listens to it.
+ * Every uart character is one slot: the start bit is the low pulse and
+ * the character read back tells what the slave did. 0xF0 at 9600 baud
+ * is a reset, anything but 0xF0 back is a presence pulse. At 115200
+ * baud 0xFF writes a 1 or reads a bit, 0x00 writes a 0. The bytes are
+ * pushed into the fifo and the caller sleeps until the last one is
+ * received, the slot timing is all done by the uart.
+ *
+ * The fastest bit is 16 clocks of w1_uart_clk, too long for the
+ * overdrive slots.
+ */
+#define UART_DR		0x00
+#define UART_FR		0x18
+#define UART_IBRD	0x24
+#define UART_FBRD	0x28
+#define UART_LCR_H	0x2C
+#define UART_CR		0x30
+#define UART_IFLS	0x34
+#define UART_IMSC	0x38
+#define UART_MIS	0x40
+#define UART_ICR	0x44
+
+#define UART_FR_BUSY	(1 << 3)
+#define UART_FR_RXFE	(1 << 4)
+#define UART_LCR_WLEN8	(3 << 5)
+#define UART_LCR_FEN	(1 << 4)
+#define UART_CR_EN	((1 << 9) | (1 << 8) | (1 << 0))	/* RXE TXE EN */
+#define UART_RXIM	(1 << 4)
+#define UART_RTIM	(1 << 6)
+
+#define W1_UART_FIFO	16
+#define W1_UART_RESET	9600
+#define W1_UART_BIT	115200
+
+static ulong w1_uart_base;
+module_param(w1_uart_base, ulong, 0);
+MODULE_PARM_DESC(w1_uart_base, "Physical address of the uart for w1_master=uart");
+
+static int w1_uart_irq = -1;
+module_param(w1_uart_irq, int, 0);
+MODULE_PARM_DESC(w1_uart_irq, "IRQ of the uart for w1_master=uart");
+
+static int w1_uart_clk = 3000000;
+module_param(w1_uart_clk, int, 0);
+MODULE_PARM_DESC(w1_uart_clk, "Reference clock of the uart (default 3MHz)");
+
+static void __iomem *w1_uart_regs;
+static DECLARE_COMPLETION(w1_uart_done);
+static u8 w1_uart_rx[W1_UART_FIFO];
+static int w1_uart_rx_len, w1_uart_rx_pos;
+
+static irqreturn_t w1_uart_isr(int irq, void *dev_id)
+{
+	u32 mis = readl(w1_uart_regs + UART_MIS);
+
+	if (!mis)
+		return IRQ_NONE;
+
+	while (!(readl(w1_uart_regs + UART_FR) & UART_FR_RXFE)) {
+		u8 c = readl(w1_uart_regs + UART_DR);
+
+		if (w1_uart_rx_pos < w1_uart_rx_len)
+			w1_uart_rx[w1_uart_rx_pos++] = c;
+	}
+	writel(mis, w1_uart_regs + UART_ICR);
+
+	if (w1_uart_rx_pos >= w1_uart_rx_len) {
+		writel(0, w1_uart_regs + UART_IMSC);
+		complete(&w1_uart_done);
+	}
+
+	return IRQ_HANDLED;
+}
+
+static void w1_uart_set_baud(int baud)
+{
+	u32 div = (w1_uart_clk * 4 + baud / 2) / baud;	/* in 1/64 */
+
+	while (readl(w1_uart_regs + UART_FR) & UART_FR_BUSY)
+		cpu_relax();
+
+	writel(0, w1_uart_regs + UART_CR);
+	writel(div >> 6, w1_uart_regs + UART_IBRD);
+	writel(div & 0x3f, w1_uart_regs + UART_FBRD);
+	/* the divisors are latched by a write of LCR_H */
+	writel(UART_LCR_WLEN8 | UART_LCR_FEN, w1_uart_regs + UART_LCR_H);
+	writel(UART_CR_EN, w1_uart_regs + UART_CR);
+}
+
+/* send n <= W1_UART_FIFO characters and wait for them to come back */
+static int w1_uart_txrx(const u8 *tx, u8 *rx, int n)
+{
+	int i;
+
+	while (!(readl(w1_uart_regs + UART_FR) & UART_FR_RXFE))
+		readl(w1_uart_regs + UART_DR);
+
+	INIT_COMPLETION(w1_uart_done);
+	w1_uart_rx_len = n;
+	w1_uart_rx_pos = 0;
+
+	for (i = 0; i < n; i++)
+		writel(tx[i], w1_uart_regs + UART_DR);
+	writel(UART_RXIM | UART_RTIM, w1_uart_regs + UART_IMSC);
+
+	if (!wait_for_completion_timeout(&w1_uart_done,
+				msecs_to_jiffies(20))) {
+		writel(0, w1_uart_regs + UART_IMSC);
+		return -ETIMEDOUT;
+	}
+
+	memcpy(rx, w1_uart_rx, n);
+	return 0;
+}
+
+static int w1_uart_reset(u32 pin)
+{
+	u8 c = 0xf0;
+	int rval;
+
+	w1_uart_set_baud(W1_UART_RESET);
+	rval = w1_uart_txrx(&c, &c, 1);
+	w1_uart_set_baud(W1_UART_BIT);
+
+	if (rval)
+		return rval;
+
+	return c == 0xf0;	/* 0 on presence, as w1_gpio_reset */
+}
+
+/* one byte is 8 characters, lsb first */
+static u8 w1_uart_xfer_8(u8 val)
+{
+	u8 buf[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		buf[i] = (val >> i) & 0x1 ? 0xff : 0x00;
+
+	if (w1_uart_txrx(buf, buf, 8))
+		return 0xff;	/* an idle bus, the CRC fails */
+
+	for (i = 0, val = 0; i < 8; i++)
+		if (buf[i] == 0xff)
+			val |= 1 << i;
+
+	return val;
+}
+
+static ssize_t w1_uart_read_block(u32 pin, u8 *buf, size_t len)
+{
+	int i;
+
+	for (i = 0; i < len; ++i)
+		buf[i] = w1_uart_xfer_8(0xff);
+
+	return len;
+}
+
+static ssize_t w1_uart_write_block(u32 pin, const u8 *buf, size_t len)
+{
+	int i;
+
+	for (i = 0; i < len; ++i)
+		w1_uart_xfer_8(buf[i]);
+
+	return len;
+}
+
+static int w1_uart_init(void)
+{
+	int rval;
+
+	if (!w1_uart_base || w1_uart_irq < 0) {
+		pr_err("%s: w1_uart_base and w1_uart_irq are needed\n",
+				DS28E10);
+		return -EINVAL;
+	}
+
+	w1_uart_regs = ioremap(w1_uart_base, 0x1000);
+	if (!w1_uart_regs)
+		return -ENOMEM;
+
+	writel(0, w1_uart_regs + UART_IMSC);
+	writel(0x7ff, w1_uart_regs + UART_ICR);
+	writel(0x2 << 3, w1_uart_regs + UART_IFLS);	/* rx at 1/2 */
+	w1_uart_set_baud(W1_UART_BIT);
+
+	rval = request_irq(w1_uart_irq, w1_uart_isr, 0, DS28E10, NULL);
+	if (rval) {
+		pr_err("%s: IRQ %d is used\n", DS28E10, w1_uart_irq);
+		iounmap(w1_uart_regs);
+		return rval;
+	}
+
+	return 0;
+}
+
+static void w1_uart_exit(void)
+{
+	writel(0, w1_uart_regs + UART_IMSC);
+	writel(0, w1_uart_regs + UART_CR);
+	free_irq(w1_uart_irq, NULL);
+	iounmap(w1_uart_regs);
+}
+
+/* ---------------------------------------------------------------- */
+/* w1 master backends */
+/* ---------------------------------------------------------------- */
+
+struct w1_master_ops {
+	const char *name;
+	int od;			/* can do overdrive */
+	int (*init)(void);
+	void (*exit)(void);
+	int (*reset)(u32 pin);	/* 0 on presence */
+	ssize_t (*read_block)(u32 pin, u8 *buf, size_t len);
+	ssize_t (*write_block)(u32 pin, const u8 *buf, size_t len);
+};
+
+static const struct w1_master_ops w1_masters[] = {
+	{
+		.name = "gpio",
+		.od = 1,
+		.init = w1_gpio_init,
+		.exit = w1_gpio_exit,
+		.reset = w1_gpio_reset,
+		.read_block = w1_gpio_read_block,
+		.write_block = w1_gpio_write_block,
+	}, {
+		.name = "uart",
+		.od = 0,
+		.init = w1_uart_init,
+		.exit = w1_uart_exit,
+		.reset = w1_uart_reset,
+		.read_block = w1_uart_read_block,
+		.write_block = w1_uart_write_block,
+	},
+};
+
+static char *w1_master = "gpio";
+module_param(w1_master, charp, 0);
+MODULE_PARM_DESC(w1_master, "How the slots are made: gpio or uart");
+
+static const struct w1_master_ops *w1_ops;
+
+static inline int w1_reset(u32 pin)
+{
+	return w1_ops->reset(pin);
+}
+
+static inline ssize_t w1_read_block(u32 pin, u8 *buf, size_t len)
+{
+	return w1_ops->read_block(pin, buf, len);
+}
+
+static inline ssize_t w1_write_block(u32 pin, const u8 *buf, size_t len)
+{
+	return w1_ops->write_block(pin, buf, len);
+}
+
+static inline void w1_write_8(u32 pin, u8 val)
+{
+	w1_ops->write_block(pin, &val, 1);
+}
+
 /* ---------------------------------------------------------------- */
 /* things about ds28e10 */
 /* ---------------------------------------------------------------- */
 
+/*
+ * Reset the bus and address the only slave on it. When od is set, go to
+ * overdrive speed by overdrive-skip-rom, which is sent at standard speed.
+ * The slave stays at overdrive until a reset at standard speed.
+ */
+static int w1_reset_select(u32 pin, int od)
+{
+	if (!w1_ops->od)
+		od = 0;
+
+	if (!od)
+		w1_t = &w1_std;
+
+	if (w1_reset(pin)) {
+		w1_t = &w1_std;
+		return -ENODEV;
+	}
+
+	if (!od || w1_t == &w1_od) {
+		w1_write_8(pin, 0xcc);	/* skip the romid */
+		return 0;
+	}
+
+	w1_write_8(pin, 0x3c);	/* overdrive skip the romid */
+	w1_t = &w1_od;
+	return 0;
+}
+
 /*
  * Due to bug of IC, we may need reset do a hardware reset for ds28e10
  * before any operation. this cost lots of time and may be unnecessary.
@@ -214,30 +748,31 @@ static ssize_t w1_gpio_write_block(u32 pin, const u8 *buf, size_t len)
 #ifdef DS28E10_HW_RESET
 static int ds28e10_hw_reset(u32 pin)
 {
-	unsigned long flags;
 	char buf[20] = {0x55, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff};
+	int rval = 0;
 
-	spin_lock_irqsave(&w1_lock, flags);
+	mutex_lock(&w1_mutex);
 
 	/* soft reset ds28e10 */
-	if (w1_gpio_reset(pin))
-		return -ENODEV;
-
-	w1_gpio_write_8(pin, 0xcc);	/* skip the romid */
-
-	w1_gpio_write_block(pin, buf, 7);
-	w1_gpio_read_block(pin, &buf[7], 2);
+	rval = w1_reset_select(pin, 0);
+	if (rval)
+		goto out;
 
-	if (crc16(0, buf, 9) != 0xb001)
-		return -EAGAIN;
+	w1_write_block(pin, buf, 7);
+	w1_read_block(pin, &buf[7], 2);
 
-	mdelay(100);	/* 100ms */
-	w1_gpio_write_8(pin, 0x00);
+	if (crc16(0, buf, 9) != 0xb001) {
+		rval = -EAGAIN;
+		goto out;
+	}
 
-	spin_unlock_irqrestore(&w1_lock, flags);
+	msleep(100);	/* 100ms */
+	w1_write_8(pin, 0x00);
 	udelay(100);	/* delay for flushing cache */
 
-	return 0;
+out:
+	mutex_unlock(&w1_mutex);
+	return rval;
 }
 #else
 static int ds28e10_hw_reset(u32 pin)
@@ -246,99 +781,245 @@ static int ds28e10_hw_reset(u32 pin)
 }
 #endif
 
+/*
+ * Read the romid at standard speed and cache it once its CRC is good.
+ * The slave is left selected, a function command may follow directly.
+ */
+static int __ds28e10_read_romid(u32 pin)
+{
+	u8 id[8];
+
+	w1_t = &w1_std;	/* there is no overdrive read-rom */
+	if (w1_reset(pin))
+		return -ENODEV;
+
+	w1_write_8(pin, 0x33);	/* send read-romid cmd */
+	w1_read_block(pin, id, 8);	/* read the 8-bytes romid */
+	if (w1_crc8(id, 8))
+		return -EAGAIN;
+
+	memcpy(w1_romid, id, 8);
+	w1_romid_valid = 1;
+	return 0;
+}
+
 static int ds28e10_get_romid(u32 pin, u8 id[8])
 {
 	int try = 0;
-	int rval;
-	unsigned long flags;
-
-	spin_lock_irqsave(&w1_lock, flags);
-	do {
-		if (w1_gpio_reset(pin)) {
-			rval = -ENODEV;
-			continue;
-		}
+	int rval = 0;
 
-		w1_gpio_write_8(pin, 0x33);	/* send read-romid cmd */
-		w1_gpio_read_block(pin, id, 8);	/* read the 8-bytes romid */
-						/* into id buffer */
-		rval = w1_crc8(id, 8) ? -EAGAIN : 0;
+	mutex_lock(&w1_mutex);
+	while (!w1_romid_valid) {
+		rval = __ds28e10_read_romid(pin);
+		if (!rval || ++try >= DS28E10_RETRY_CN)
+			break;
+	}
 
-	} while (rval && (++try < DS28E10_RETRY_CN));
-	spin_unlock_irqrestore(&w1_lock, flags);
+	if (!rval)
+		memcpy(id, w1_romid, 8);
+	mutex_unlock(&w1_mutex);
 
 	return rval;
 }
 
-static int ds28e10_write_challenge(u32 pin, u8 *buf)
+/* the slave must have been selected */
+static int __ds28e10_write_challenge(u32 pin, u8 *buf)
 {
-	int rval;
 	u8 challenge[12];
 
-	rval = w1_gpio_reset(pin);
-	if (rval)
-		return -ENODEV;
-
-	w1_gpio_write_8(pin, 0xcc);	/* skip the romid */
-	w1_gpio_write_8(pin, 0x0F);	/* write-challenge command */
+	w1_write_8(pin, 0x0F);	/* write-challenge command */
 
 	/* write 12-byte challenge and then read it back */
-	w1_gpio_write_block(pin, buf, 12);
-	w1_gpio_read_block(pin, challenge, 12);
+	w1_write_block(pin, buf, 12);
+	w1_read_block(pin, challenge, 12);
 
 	return memcmp(challenge, buf, 12) ? -EAGAIN : 0;
 }
 
-static int ds28e10_get_mac(u32 pin, struct ds28e10_mac_data *pdata)
+static int ds28e10_write_challenge(u32 pin, u8 *buf, int od)
+{
+	int rval;
+
+	rval = w1_reset_select(pin, od);
+	if (rval)
+		return rval;
+
+	return __ds28e10_write_challenge(pin, buf);
+}
+
+/* the computation of MAC is started by the reset after write-challenge */
+static int ds28e10_read_page_mac(u32 pin, struct ds28e10_mac_data *pdata,
+		int od)
 {
 	u8 buf[34] = {0};
 	int rval;
+
+	rval = w1_reset_select(pin, od);
+	if (rval)
+		return rval;
+
+	/* read authentication page 0000h */
+	buf[0] = 0xa5;
+	buf[1] = 0x00;
+	buf[2] = 0x00;
+	w1_write_block(pin, buf, 3);
+
+	/* get the 28-bytes OTP, 0xFF and CRC16 */
+	w1_read_block(pin, &buf[3], 28 + 3);
+	if (crc16(0, buf, 34) != 0xb001)
+		return -EAGAIN;
+
+	memcpy(pdata->pagedata, &buf[3], 28);
+
+	/* waiting for Tcsha, the bus is idle meanwhile */
+	w1_wait_us(2000);
+
+	/* get the 20-bytes MAC and CRC16 */
+	w1_read_block(pin, pdata->mac, 20 + 2);
+	if (crc16(0, pdata->mac, 22) != 0xb001)
+		return -EAGAIN;
+
+	return 0;
+}
+
+static void ds28e10_leave_od(u32 pin)
+{
+	if (w1_t != &w1_std) {	/* leave the slave at standard speed */
+		w1_t = &w1_std;
+		w1_reset(pin);
+	}
+}
+
+/* a retry is at standard speed, the overdrive attempt failed then */
+static void w1_od_account(int try)
+{
+	if (!overdrive || !w1_ops->od)
+		return;
+
+	w1_od_tries++;
+	if (try) {
+		w1_od_fallbacks++;
+		pr_debug("%s: overdrive failed, standard speed\n", DS28E10);
+	}
+}
+
+static int ds28e10_get_mac(u32 pin, struct ds28e10_mac_data *pdata)
+{
+	int rval;
 	int try = 0;
-	unsigned long flags;
+	int od = overdrive;
 
-	spin_lock_irqsave(&w1_lock, flags);
+	mutex_lock(&w1_mutex);
 	do {
-		rval = ds28e10_write_challenge(pin, pdata->challenge);
-		if (rval)
-			continue;
+		/* fall back to standard speed once anything goes wrong */
+		if (try)
+			od = 0;
 
-		rval = w1_gpio_reset(pin);
+		rval = ds28e10_write_challenge(pin, pdata->challenge, od);
 		if (rval)
 			continue;
 
-		w1_gpio_write_8(pin, 0xcc);	/* skip the romid */
+		rval = ds28e10_read_page_mac(pin, pdata, od);
+	} while (rval && ++try < DS28E10_RETRY_CN);
 
-		/* read authentication page 0000h */
-		buf[0] = 0xa5;
-		buf[1] = 0x00;
-		buf[2] = 0x00;
-		w1_gpio_write_block(pin, buf, 3);
+	w1_od_account(try);
+	ds28e10_leave_od(pin);
+	mutex_unlock(&w1_mutex);
 
-		/* get the 28-bytes OTP, 0xFF and CRC16 */
-		w1_gpio_read_block(pin, &buf[3], 28 + 3);
-		if (crc16(0, buf, 34) != 0xb001) {
-			rval = -EAGAIN;
-			continue;
-		}
+	return rval;
+}
 
-		memcpy(pdata->pagedata, &buf[3], 28);
+/*
+ * romid, challenge, page and MAC with two resets. If the romid is not
+ * known yet, it is read by the first reset instead of skipping it, and
+ * the challenge follows the read-rom.
+ */
+static int ds28e10_authenticate(u32 pin, struct ds28e10_auth_data *pdata)
+{
+	struct ds28e10_mac_data mac;
+	int rval;
+	int try = 0;
+	int od = overdrive;
+
+	memset(&mac, 0, sizeof(mac));
+	get_random_bytes(mac.challenge, 12);
 
-		/* waiting for Tcsha */
-		udelay(2000);
+	mutex_lock(&w1_mutex);
+	do {
+		if (try)
+			od = 0;
+
+		if (!w1_romid_valid) {
+			rval = __ds28e10_read_romid(pin);
+			if (!rval)
+				rval = __ds28e10_write_challenge(pin,
+						mac.challenge);
+		} else {
+			rval = ds28e10_write_challenge(pin, mac.challenge, od);
+		}
+		if (rval)
+			continue;
 
-		/* get the 20-bytes MAC and CRC16 */
-		w1_gpio_read_block(pin, pdata->mac, 20 + 2);
-		if (crc16(0, pdata->mac, 22) != 0xb001)
-			rval = -EAGAIN;
+		rval = ds28e10_read_page_mac(pin, &mac, od);
 	} while (rval && ++try < DS28E10_RETRY_CN);
-	spin_unlock_irqrestore(&w1_lock, flags);
+
+	w1_od_account(try);
+	ds28e10_leave_od(pin);
+	if (!rval)
+		memcpy(pdata->romid, w1_romid, 8);
+	mutex_unlock(&w1_mutex);
+
+	memcpy(pdata->challenge, mac.challenge, 12);
+	memcpy(pdata->pagedata, mac.pagedata, 32);
+	memcpy(pdata->mac, mac.mac, 22);
 
 	return rval;
 }
 
+static void ds28e10_mac_work(struct work_struct *work)
+{
+	struct ds28e10_file *df = container_of(work, struct ds28e10_file, work);
+	int rval;
+
+	rval = ds28e10_get_mac(w1_pin, &df->mac);
+
+	/*
+	 * read() returns the status, -EAGAIN there means "not ready" and a
+	 * CRC error would be retried forever by a poll() based reader.
+	 */
+	if (rval == -EAGAIN)
+		rval = -EIO;
+
+	spin_lock_irq(&df->lock);
+	df->status = rval;
+	df->busy = 0;
+	df->ready = 1;
+	spin_unlock_irq(&df->lock);
+
+	wake_up_interruptible(&df->wait);
+	kill_fasync(&df->fasync, SIGIO, POLL_IN);
+}
+
+static int ds28e10_submit_mac(struct ds28e10_file *df)
+{
+	spin_lock_irq(&df->lock);
+	if (df->busy) {
+		spin_unlock_irq(&df->lock);
+		return -EBUSY;
+	}
+	df->busy = 1;
+	df->ready = 0;
+	spin_unlock_irq(&df->lock);
+
+	get_random_bytes((void *)(df->mac.challenge), 12);
+	queue_work(ds28e10_wq, &df->work);
+	return 0;
+}
+
 static long ds28e10_ioctl(struct file *fp, u32 cmd, ulong arg)
 {
 	struct ds28e10_mac_data mac;
+	struct ds28e10_auth_data auth;
 	u8 romid[8];
 	int rval = -ENOTTY;
 
@@ -352,24 +1033,148 @@ static long ds28e10_ioctl(struct file *fp, u32 cmd, ulong arg)
 		rval = ds28e10_get_mac(w1_pin, &mac);
 		if (!rval && copy_to_user((void *)arg, &mac, sizeof(mac)))
 		       rval = -EFAULT;
+
+	} else if (cmd == IOCTL_SUBMIT_MAC) {
+		rval = ds28e10_submit_mac(fp->private_data);
+
+	} else if (cmd == IOCTL_GET_BOOT_AUTH) {
+		/* what u-boot found, struct tag_ds28e10 */
+		rval = hi_ds28e10_boot_tag ? 0 : -ENODATA;
+		if (!rval && copy_to_user((void *)arg, hi_ds28e10_boot_tag,
+					sizeof(*hi_ds28e10_boot_tag)))
+		       rval = -EFAULT;
+
+	} else if (cmd == IOCTL_AUTHENTICATE) {
+		rval = ds28e10_authenticate(w1_pin, &auth);
+		if (!rval && copy_to_user((void *)arg, &auth, sizeof(auth)))
+		       rval = -EFAULT;
 	}
 
 	return rval;
 }
 
+static ssize_t ds28e10_read(struct file *fp, char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	struct ds28e10_file *df = fp->private_data;
+	struct ds28e10_mac_data mac;
+	int rval;
+
+	if (count < sizeof(df->mac))
+		return -EINVAL;
+
+	spin_lock_irq(&df->lock);
+	while (!df->ready) {
+		if (!df->busy) {	/* nothing submitted */
+			spin_unlock_irq(&df->lock);
+			return -ENODATA;
+		}
+		spin_unlock_irq(&df->lock);
+
+		if (fp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(df->wait, df->ready))
+			return -ERESTARTSYS;
+
+		spin_lock_irq(&df->lock);
+	}
+	df->ready = 0;
+	rval = df->status;
+	mac = df->mac;		/* may be resubmitted once unlocked */
+	spin_unlock_irq(&df->lock);
+
+	if (rval)
+		return rval;
+
+	if (copy_to_user(buf, &mac, sizeof(mac)))
+		return -EFAULT;
+
+	return sizeof(mac);
+}
+
+static unsigned int ds28e10_poll(struct file *fp, poll_table *wait)
+{
+	struct ds28e10_file *df = fp->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(fp, &df->wait, wait);
+
+	spin_lock_irq(&df->lock);
+	if (df->ready)
+		mask |= POLLIN | POLLRDNORM;
+	spin_unlock_irq(&df->lock);
+
+	return mask;
+}
+
+static int ds28e10_fasync(int fd, struct file *fp, int on)
+{
+	struct ds28e10_file *df = fp->private_data;
+
+	return fasync_helper(fd, fp, on, &df->fasync);
+}
+
+static ssize_t ds28e10_irqoff_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", w1_irqoff_max);
+}
+
+/* write anything to restart the measurement */
+static ssize_t ds28e10_irqoff_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	mutex_lock(&w1_mutex);
+	w1_irqoff_max = 0;
+	mutex_unlock(&w1_mutex);
+
+	return count;
+}
+
+static DEVICE_ATTR(irqoff_max_ns, S_IRUGO | S_IWUSR,
+		ds28e10_irqoff_show, ds28e10_irqoff_store);
+
+/* "tries fallbacks" of the overdrive requests */
+static ssize_t ds28e10_od_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu %lu\n", w1_od_tries, w1_od_fallbacks);
+}
+
+static DEVICE_ATTR(od_fallbacks, S_IRUGO, ds28e10_od_show, NULL);
+
 static int ds28e10_open(struct inode *inode, struct file *filp)
 {
+	struct ds28e10_file *df;
+
+	df = kzalloc(sizeof(*df), GFP_KERNEL);
+	if (!df)
+		return -ENOMEM;
+
+	spin_lock_init(&df->lock);
+	INIT_WORK(&df->work, ds28e10_mac_work);
+	init_waitqueue_head(&df->wait);
+
+	filp->private_data = df;
 	return 0;
 }
 
 static int ds28e10_release(struct inode *inode, struct file *filp)
 {
+	struct ds28e10_file *df = filp->private_data;
+
+	cancel_work_sync(&df->work);
+	ds28e10_fasync(-1, filp, 0);
+	kfree(df);
 	return 0;
 }
 
 static const struct file_operations ds28e10_fops = {
 	.owner = THIS_MODULE,
 	.open = ds28e10_open,
+	.read = ds28e10_read,
+	.poll = ds28e10_poll,
+	.fasync = ds28e10_fasync,
 	.unlocked_ioctl = ds28e10_ioctl,
 	.release = ds28e10_release
 };
@@ -383,26 +1188,63 @@ static struct miscdevice ds28e10_dev = {
 static int __init ds28e10_init(void)
 {
 	int rval;
+	int i;
 
-	if (!gpio_is_valid(w1_pin)) {
-		pr_err("%s: %d is invalid GPIO port\n", DS28E10, w1_pin);
-		return -EFAULT;
+	for (i = 0; i < ARRAY_SIZE(w1_masters); i++) {
+		if (!strcmp(w1_master, w1_masters[i].name))
+			w1_ops = &w1_masters[i];
+	}
+	if (!w1_ops) {
+		pr_err("%s: no w1 master %s\n", DS28E10, w1_master);
+		return -EINVAL;
 	}
 
-	rval = gpio_request(w1_pin, DS28E10);
-	if (rval) {
-		pr_err("%s: %d is used\n", DS28E10, w1_pin);
-		return -EBUSY;
+	rval = w1_ops->init();
+	if (rval)
+		return rval;
+
+	/* u-boot has read the romid already */
+	if (hi_ds28e10_boot_tag && hi_ds28e10_boot_tag->romid_ok) {
+		memcpy(w1_romid, hi_ds28e10_boot_tag->romid, 8);
+		w1_romid_valid = 1;
 	}
 
 	ds28e10_hw_reset(w1_pin);
-	return misc_register(&ds28e10_dev);
+
+	/* the bus is serialized anyway, one thread is enough */
+	ds28e10_wq = create_singlethread_workqueue(DS28E10);
+	if (!ds28e10_wq) {
+		w1_ops->exit();
+		return -ENOMEM;
+	}
+
+	rval = misc_register(&ds28e10_dev);
+	if (rval) {
+		destroy_workqueue(ds28e10_wq);
+		w1_ops->exit();
+		return rval;
+	}
+
+	rval = device_create_file(ds28e10_dev.this_device,
+			&dev_attr_irqoff_max_ns);
+	if (rval)
+		pr_warning("%s: no irqoff_max_ns attribute\n", DS28E10);
+
+	rval = device_create_file(ds28e10_dev.this_device,
+			&dev_attr_od_fallbacks);
+	if (rval)
+		pr_warning("%s: no od_fallbacks attribute\n", DS28E10);
+
+	return 0;
 }
 
 static void __exit ds28e10_exit(void)
 {
-	gpio_free(w1_pin);
+	device_remove_file(ds28e10_dev.this_device, &dev_attr_od_fallbacks);
+	device_remove_file(ds28e10_dev.this_device, &dev_attr_irqoff_max_ns);
 	misc_deregister(&ds28e10_dev);
+	destroy_workqueue(ds28e10_wq);
+	w1_ops->exit();
 }
 
 module_init(ds28e10_init);
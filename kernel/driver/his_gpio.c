@@ -95,6 +95,98 @@ static int his_gpio_direction_output(struct gpio_chip *gc, u32 offset, int val)
 	return 0;
 }
 
+int his_gpio_fast_request(unsigned gpio, struct his_gpio_fast *fast)
+{
+	u32 base;
+
+	if (gpio >= ARCH_NR_GPIOS || !chipbase[gpio / GPIO_CHIPSIZE])
+		return -EINVAL;
+
+	base = chipbase[gpio / GPIO_CHIPSIZE];
+	gpio %= GPIO_CHIPSIZE;
+
+	fast->data = (void __iomem *)IO_ADDRESS(base + (1 << (gpio + 2)));
+	fast->dir = (void __iomem *)IO_ADDRESS(base + GPIO_DIR_OFF);
+	fast->mask = 1 << gpio;
+
+	return 0;
+}
+EXPORT_SYMBOL(his_gpio_fast_request);
+
+static struct his_gpio *his_gpio_bank(unsigned gpio)
+{
+	if (gpio >= ARCH_NR_GPIOS || !chipbase[gpio / GPIO_CHIPSIZE])
+		return NULL;
+
+	return &hisgpio[gpio / GPIO_CHIPSIZE];
+}
+
+/* an edge interrupt on the rising or the falling edge */
+int his_gpio_irq_enable(unsigned gpio, int rising)
+{
+	struct his_gpio *bank = his_gpio_bank(gpio);
+	u32 mask = 1 << (gpio % GPIO_CHIPSIZE);
+	unsigned long flags;
+	u32 val;
+
+	if (!bank)
+		return -EINVAL;
+
+	spin_lock_irqsave(&bank->lock, flags);
+	val = his_readl(bank->base + GPIO_IS_OFF);
+	his_writel(val & ~mask, bank->base + GPIO_IS_OFF);
+	val = his_readl(bank->base + GPIO_IBE_OFF);
+	his_writel(val & ~mask, bank->base + GPIO_IBE_OFF);
+	val = his_readl(bank->base + GPIO_IEV_OFF);
+	val = rising ? val | mask : val & ~mask;
+	his_writel(val, bank->base + GPIO_IEV_OFF);
+
+	his_writel(mask, bank->base + GPIO_IC_OFF);
+	val = his_readl(bank->base + GPIO_IE_OFF);
+	his_writel(val | mask, bank->base + GPIO_IE_OFF);
+	spin_unlock_irqrestore(&bank->lock, flags);
+
+	return 0;
+}
+EXPORT_SYMBOL(his_gpio_irq_enable);
+
+void his_gpio_irq_disable(unsigned gpio)
+{
+	struct his_gpio *bank = his_gpio_bank(gpio);
+	u32 mask = 1 << (gpio % GPIO_CHIPSIZE);
+	unsigned long flags;
+	u32 val;
+
+	if (!bank)
+		return;
+
+	spin_lock_irqsave(&bank->lock, flags);
+	val = his_readl(bank->base + GPIO_IE_OFF);
+	his_writel(val & ~mask, bank->base + GPIO_IE_OFF);
+	his_writel(mask, bank->base + GPIO_IC_OFF);
+	spin_unlock_irqrestore(&bank->lock, flags);
+}
+EXPORT_SYMBOL(his_gpio_irq_disable);
+
+int his_gpio_irq_pending(unsigned gpio)
+{
+	struct his_gpio *bank = his_gpio_bank(gpio);
+	u32 mask = 1 << (gpio % GPIO_CHIPSIZE);
+
+	return bank && (his_readl(bank->base + GPIO_MIS_OFF) & mask);
+}
+EXPORT_SYMBOL(his_gpio_irq_pending);
+
+/* the clear register is write-one-to-clear, no lock is needed */
+void his_gpio_irq_ack(unsigned gpio)
+{
+	struct his_gpio *bank = his_gpio_bank(gpio);
+
+	if (bank)
+		his_writel(1 << (gpio % GPIO_CHIPSIZE), bank->base + GPIO_IC_OFF);
+}
+EXPORT_SYMBOL(his_gpio_irq_ack);
+
 static int __init his_gpio_init(void)
 {
 	int i;
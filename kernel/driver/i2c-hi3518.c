@@ -25,6 +25,10 @@
 #include <linux/miscdevice.h>
 
 #include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <linux/slab.h>
+#include <linux/gpio.h>
+#include <linux/ktime.h>
 #include <linux/init.h>
 #include <linux/interrupt.h>
 #include <linux/delay.h>
@@ -32,8 +36,21 @@
 #include <linux/io.h>
 #include <asm/uaccess.h>
 #include <linux/mutex.h>
+#include <asm/div64.h>
 
-#define APB_CLK		110000000
+#define APB_CLK		110000000	/* if the CRG says nonsense */
+
+/*
+ * The bus PLL, APB runs at half of the bus clock:
+ * busclk = 24MHz / refdiv * fbdiv / (pstdiv1 * pstdiv2) / 2
+ */
+#define CRG_REG_BASE	0x20030000
+#define CRG_PLL_CFG0	0x010	/* [26:24] pstdiv2, [29:27] pstdiv1 */
+#define CRG_PLL_CFG1	0x014	/* [11:0] fbdiv, [17:12] refdiv */
+#define CRG_PLL_REF	24000000
+
+#define I2C_SPEED_STD	100000
+#define I2C_SPEED_MAX	1000000
 
 #define I2C_IRQNO	20
 #define I2C_IRQEN	(1 << 7)
@@ -63,6 +80,54 @@
 #define I2C_OVER_INTR	(1 << 0)
 #define I2C_ICR_CLRALL	(0x7F)
 
+/* the default SCL rate, client_speed in sysfs sets it per client */
+static int bus_speed = I2C_SPEED_STD;
+module_param(bus_speed, int, 0444);
+MODULE_PARM_DESC(bus_speed, "SCL rate in Hz, up to 1MHz (default 100k)");
+
+/*
+ * Transfers of at most poll_thresh bytes, the address bytes included,
+ * are done by polling I2C_SR_REG instead of an IRQ per byte and a
+ * wakeup at the end. 0 disables polling.
+ */
+static int poll_thresh = 8;
+module_param(poll_thresh, int, 0644);
+MODULE_PARM_DESC(poll_thresh, "Poll the transfers up to this many bytes");
+
+/*
+ * Low class transfers longer than split_len bytes run one message at a
+ * time, and let the higher classes in between.
+ */
+static int split_len = 32;
+module_param(split_len, int, 0644);
+MODULE_PARM_DESC(split_len, "Split the low class transfers above this");
+
+/* bucket n counts the transfers of [2^(n-1), 2^n) us, the last is open */
+#define I2C_LAT_BUCKETS	16
+
+#define I2C_PRIO_HIGH	0
+#define I2C_PRIO_NORMAL	1
+#define I2C_PRIO_LOW	2
+#define I2C_PRIO_NR	3
+
+struct hisi2c_sched_stats {
+	unsigned long		nr;	/* times the bus was granted */
+	unsigned long		splits;	/* times it was handed over */
+	u64			wait_sum;	/* us */
+	u32			wait_max;
+};
+
+/* see hisi2c_lock() */
+struct hisi2c_sched {
+	spinlock_t		lock;
+	wait_queue_head_t	wait;
+	int			busy;
+	int			held;	/* a class paused in a split */
+	unsigned int		next[I2C_PRIO_NR];	/* next ticket given */
+	unsigned int		serving[I2C_PRIO_NR];	/* next to run */
+	struct hisi2c_sched_stats st[I2C_PRIO_NR];
+};
+
 struct hisi2c_adap {
 	struct mutex mutex;
 	wait_queue_head_t	wait;
@@ -71,6 +136,20 @@ struct hisi2c_adap {
 	unsigned int		msg_num;
 	unsigned int		msg_addr;
 	unsigned int		msg_ptr;
+	int			stopping;	/* the stop is being sent */
+	int			done;	/* the stop has completed */
+
+	u32			apb_clk;
+	u32			speed;		/* the default SCL rate */
+	u32			cur_speed;	/* the dividers are set for */
+	u32			client_speed[128];	/* 0: the default */
+	u8			client_prio[128];	/* I2C_PRIO_* */
+
+	struct hisi2c_sched	sched;
+
+	unsigned long		nr_irq;	/* transfers by IRQ */
+	unsigned long		nr_poll;	/* transfers by polling */
+	unsigned long		lat_hist[2][I2C_LAT_BUCKETS];	/* irq, poll */
 
 	unsigned int		irq;
 	void __iomem		*regs;
@@ -80,20 +159,71 @@ struct hisi2c_adap {
 
 static struct hisi2c_adap hisi2c_adap;
 
-static void hisi2c_set_clk(struct hisi2c_adap *i2c, u32 rate)
+static u32 hisi2c_apb_clk(void)
+{
+	void __iomem *crg = ioremap_nocache(CRG_REG_BASE, 0x1000);
+	u32 cfg0, cfg1, fbdiv, refdiv, pstdiv1, pstdiv2;
+	u64 clk;
+
+	if (!crg)
+		return APB_CLK;
+
+	cfg0 = readl(crg + CRG_PLL_CFG0);
+	cfg1 = readl(crg + CRG_PLL_CFG1);
+	iounmap(crg);
+
+	pstdiv2 = (cfg0 >> 24) & 0x7;
+	pstdiv1 = (cfg0 >> 27) & 0x7;
+	fbdiv = cfg1 & 0xfff;
+	refdiv = (cfg1 >> 12) & 0x3f;
+
+	if (!pstdiv1 || !pstdiv2 || !fbdiv || !refdiv)
+		return APB_CLK;
+
+	clk = (u64)CRG_PLL_REF * fbdiv;
+	do_div(clk, refdiv * pstdiv1 * pstdiv2 * 2 * 2);
+
+	/* what the SoC can run at */
+	if (clk < 20000000 || clk > 200000000)
+		return APB_CLK;
+
+	return clk;
+}
+
+/*
+ * SCL high and low are (reg + 1) * 2 APB cycles. Standard mode has even
+ * duty, faster modes need a longer low: 36/64 meets tLOW/tHIGH of both
+ * fast mode and fast mode plus.
+ */
+static void hisi2c_set_dividers(struct hisi2c_adap *i2c, u32 rate)
 {
-	u32 scl = 0;
-	u32 apb_clk = APB_CLK;
+	u32 sclh, scll;
 
-	scl = (apb_clk / (rate * 2)) / 2 - 1;
-	writel(scl, i2c->regs + I2C_SCLH_REG);
-	writel(scl, i2c->regs + I2C_SCLL_REG);
+	if (rate <= I2C_SPEED_STD) {
+		sclh = (i2c->apb_clk / (rate * 2)) / 2 - 1;
+		scll = sclh;
+	} else {
+		sclh = (i2c->apb_clk / 100 * 36 / rate) / 2 - 1;
+		scll = (i2c->apb_clk / 100 * 64 / rate) / 2 - 1;
+	}
 
+	writel(sclh, i2c->regs + I2C_SCLH_REG);
+	writel(scll, i2c->regs + I2C_SCLL_REG);
+	i2c->cur_speed = rate;
+}
+
+static void hisi2c_hw_init(struct hisi2c_adap *i2c)
+{
 	/* enable i2c and its irq */
 	writel(I2C_IRQMOD, i2c->regs + I2C_CTRL_REG);
 	writel(I2C_ICR_CLRALL, i2c->regs + I2C_ICR_REG);
 }
 
+static int hisi2c_valid_speed(u32 rate)
+{
+	return rate >= 10000 && rate <= I2C_SPEED_MAX;
+}
+
 static inline void hisi2c_enable_irq(struct hisi2c_adap *i2c)
 {
 	u32 val = readl(i2c->regs + I2C_CTRL_REG);
@@ -131,15 +261,23 @@ static void hisi2c_msg_start(struct hisi2c_adap *i2c)
 	writel(I2C_CMD_WR | I2C_CMD_START, i2c->regs + I2C_COM_REB);
 }
 
+/* the transfer is done once the stop condition has completed */
 static void hisi2c_msg_stop(struct hisi2c_adap *i2c)
 {
-	hisi2c_disable_irq(i2c);
-
 	/* msg_num is used by hisi2c_xfer to calculate return value */
 	i2c->msg_ptr = 0;
 	i2c->msg_addr = 0;
 
+	i2c->stopping = 1;
 	writel(I2C_CMD_STOP, i2c->regs + I2C_COM_REB);
+}
+
+static void hisi2c_msg_done(struct hisi2c_adap *i2c)
+{
+	hisi2c_disable_irq(i2c);
+
+	i2c->stopping = 0;
+	i2c->done = 1;
 	wake_up(&i2c->wait);
 }
 
@@ -163,22 +301,35 @@ static void hisi2c_msg_write(struct hisi2c_adap *i2c, u32 state)
 {
 	int val;
 
-	if (state & I2C_NACK_INTR) {
-		pr_err("slave%x: no ack, state(%x)", i2c->msg_addr, state);
-		return hisi2c_msg_stop(i2c);
-	}
-
 	val = i2c->msg->buf[i2c->msg_ptr++];
 	writel(val, i2c->regs + I2C_TXR_REG);
 	writel(I2C_CMD_WR, i2c->regs + I2C_COM_REB);
 }
 
-static irqreturn_t hisi2c_irq(int irqno, void *dev_id)
+/* one step of the transfer, after a command has completed */
+static void hisi2c_step(struct hisi2c_adap *i2c)
 {
-	struct hisi2c_adap *i2c = dev_id;
 	u32 state = readl(i2c->regs + I2C_SR_REG);
 
-	if (is_msgend(i2c)) {
+	if (i2c->stopping) {
+		hisi2c_msg_done(i2c);
+
+	} else if (state & I2C_NACK_INTR && (state & I2C_START_INTR
+				|| !(i2c->msg->flags & I2C_M_RD))) {
+		/*
+		 * The address or a byte written is not acked, abort. The
+		 * address is not acked by design when a busy device is
+		 * polled, it is no error there.
+		 */
+		if (state & I2C_START_INTR)
+			pr_debug("slave%x: no ack, state(%x)\n",
+					i2c->msg_addr, state);
+		else
+			pr_err("slave%x: no ack, state(%x)\n",
+					i2c->msg_addr, state);
+		hisi2c_msg_stop(i2c);
+
+	} else if (is_msgend(i2c)) {
 
 		i2c->msg_num--;
 		if (i2c->msg_num) {
@@ -196,46 +347,265 @@ static irqreturn_t hisi2c_irq(int irqno, void *dev_id)
 	}
 
 	writel(I2C_ICR_CLRALL, i2c->regs + I2C_ICR_REG);
+}
+
+static irqreturn_t hisi2c_irq(int irqno, void *dev_id)
+{
+	hisi2c_step(dev_id);
 	return IRQ_HANDLED;
 }
 
-static int hisi2c_doxfer(struct hisi2c_adap *i2c, struct i2c_msg *msgs, int num)
+/*
+ * The same steps as in IRQ mode, but the IRQ stays disabled and the
+ * status register is polled for the completion of each command.
+ */
+static int hisi2c_poll(struct hisi2c_adap *i2c)
 {
-	unsigned long timeout;
+	unsigned long end = jiffies + msecs_to_jiffies(100);
 	u32 state;
-	int spins = 20;
-	int rval;
 
-	mutex_lock(&i2c->mutex);
+	hisi2c_msg_start(i2c);
+
+	while (!i2c->done) {
+		state = readl(i2c->regs + I2C_SR_REG);
+		if (state & (I2C_OVER_INTR | I2C_NACK_INTR)) {
+			hisi2c_step(i2c);
+			continue;
+		}
+
+		if (time_after(jiffies, end))
+			return 0;
+		cpu_relax();
+	}
+
+	return 1;
+}
+
+static int hisi2c_xfer_len(struct i2c_msg *msgs, int num)
+{
+	int i, len = 0;
+
+	for (i = 0; i < num; i++)
+		len += msgs[i].len + 1;
+
+	return len;
+}
+
+static void hisi2c_lat_account(struct hisi2c_adap *i2c, int poll, ktime_t t)
+{
+	int n = fls(ktime_to_us(t));
+
+	i2c->lat_hist[poll][min(n, I2C_LAT_BUCKETS - 1)]++;
+}
+
+/* the caller holds i2c->mutex */
+static int __hisi2c_doxfer(struct hisi2c_adap *i2c, struct i2c_msg *msgs,
+		int num)
+{
+	unsigned long timeout;
+	ktime_t start;
+	u32 speed;
+	int rval, poll;
+
+	speed = i2c->client_speed[msgs[0].addr & 0x7f];
+	if (!speed)
+		speed = i2c->speed;
+	if (speed != i2c->cur_speed)
+		hisi2c_set_dividers(i2c, speed);
+
 	i2c->msg = msgs;
 	i2c->msg_num = num;
-	hisi2c_enable_irq(i2c);
-	hisi2c_msg_start(i2c);
+	i2c->stopping = 0;
+	i2c->done = 0;
+
+	start = ktime_get();
+	poll = hisi2c_xfer_len(msgs, num) <= poll_thresh;
+	if (poll) {
+		i2c->nr_poll++;
+		timeout = hisi2c_poll(i2c);
+	} else {
+		i2c->nr_irq++;
+		hisi2c_enable_irq(i2c);
+		hisi2c_msg_start(i2c);
+		timeout = wait_event_timeout(i2c->wait, i2c->done, 5 * HZ);
+	}
 
-	timeout = wait_event_timeout(i2c->wait, i2c->msg_num == 0, 5 * HZ);
+	if (!i2c->done)
+		hisi2c_disable_irq(i2c);
 	rval = num - i2c->msg_num;
 
 	if (timeout == 0)
 		pr_err("timeout\n");
 	else if (rval != num)
-		pr_err("incomplete xfer (%d)\n", rval);
+		pr_debug("incomplete xfer (%d)\n", rval);
+	else
+		hisi2c_lat_account(i2c, poll, ktime_sub(ktime_get(), start));
 
-	/* first, try busy waiting briefly */
-	do {
-		state = readl(i2c->regs + I2C_SR_REG);
-	} while (!(state & I2C_OVER_INTR) && --spins);
+	writel(I2C_ICR_CLRALL, i2c->regs + I2C_ICR_REG);
+	return rval;
+}
 
-	/* if that timed out sleep */
-	if (!spins) {
-		msleep(1);
-		state = readl(i2c->regs + I2C_SR_REG);
+/* ----------------------------------------------------------------- */
+/* bus scheduler */
+/* ----------------------------------------------------------------- */
+
+/*
+ * Everything that goes on the bus first takes a ticket of the class of
+ * its client address. The bus is given to the oldest ticket of the
+ * highest class that has one, so a high class transfer waits for at most
+ * the transfer on the bus, or the message on the bus if that is a split
+ * low class one. The lower classes may starve while the higher ones keep
+ * the bus busy. i2c->mutex is still taken by the owner, it protects the
+ * settings and caches against the sysfs and the other callers.
+ */
+static inline int hisi2c_prio(struct hisi2c_adap *i2c, u16 addr)
+{
+	return i2c->client_prio[addr & 0x7f];
+}
+
+/* a ticket of a class above prio is waiting */
+static int hisi2c_sched_waiting(struct hisi2c_sched *s, int prio)
+{
+	int c;
+
+	for (c = 0; c < prio; c++) {
+		if (s->next[c] != s->serving[c])
+			return 1;
 	}
 
-	if (!(state & I2C_OVER_INTR))
-		pr_debug("hisi2c: timeout waiting for bus idle\n");
+	return 0;
+}
+
+static int hisi2c_sched_turn(struct hisi2c_sched *s, int prio,
+		unsigned int ticket)
+{
+	int rval = 0;
+
+	spin_lock(&s->lock);
+	if (!s->busy && prio < s->held && ticket == s->serving[prio]
+			&& !hisi2c_sched_waiting(s, prio)) {
+		s->serving[prio]++;
+		s->busy = 1;
+		rval = 1;
+	}
+	spin_unlock(&s->lock);
+
+	return rval;
+}
+
+static void hisi2c_lock(struct hisi2c_adap *i2c, int prio)
+{
+	struct hisi2c_sched *s = &i2c->sched;
+	unsigned int ticket;
+	ktime_t start;
+	u32 us;
+
+	start = ktime_get();
+	spin_lock(&s->lock);
+	ticket = s->next[prio]++;
+	spin_unlock(&s->lock);
+
+	wait_event(s->wait, hisi2c_sched_turn(s, prio, ticket));
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+
+	spin_lock(&s->lock);
+	s->st[prio].nr++;
+	s->st[prio].wait_sum += us;
+	s->st[prio].wait_max = max(s->st[prio].wait_max, us);
+	spin_unlock(&s->lock);
+
+	mutex_lock(&i2c->mutex);
+}
+
+static void hisi2c_unlock(struct hisi2c_adap *i2c)
+{
+	struct hisi2c_sched *s = &i2c->sched;
+
+	mutex_unlock(&i2c->mutex);
+
+	spin_lock(&s->lock);
+	s->busy = 0;
+	spin_unlock(&s->lock);
+	wake_up_all(&s->wait);
+}
+
+static int hisi2c_sched_resume(struct hisi2c_sched *s, int prio)
+{
+	int rval = 0;
+
+	spin_lock(&s->lock);
+	if (!s->busy && !hisi2c_sched_waiting(s, prio)) {
+		s->held = I2C_PRIO_NR;
+		s->busy = 1;
+		rval = 1;
+	}
+	spin_unlock(&s->lock);
+
+	return rval;
+}
+
+/*
+ * Between two messages of a split transfer: the waiting higher classes
+ * go first, the transfer then goes on before any other of its class.
+ */
+static void hisi2c_yield(struct hisi2c_adap *i2c, int prio)
+{
+	struct hisi2c_sched *s = &i2c->sched;
+
+	spin_lock(&s->lock);
+	if (!hisi2c_sched_waiting(s, prio)) {
+		spin_unlock(&s->lock);
+		return;
+	}
+	s->st[prio].splits++;
+	s->held = prio;
+	s->busy = 0;
+	spin_unlock(&s->lock);
 
-	writel(I2C_ICR_CLRALL, i2c->regs + I2C_ICR_REG);
 	mutex_unlock(&i2c->mutex);
+	wake_up_all(&s->wait);
+
+	wait_event(s->wait, hisi2c_sched_resume(s, prio));
+	mutex_lock(&i2c->mutex);
+}
+
+static void hisi2c_sched_init(struct hisi2c_adap *i2c)
+{
+	spin_lock_init(&i2c->sched.lock);
+	init_waitqueue_head(&i2c->sched.wait);
+	i2c->sched.held = I2C_PRIO_NR;
+	memset(i2c->client_prio, I2C_PRIO_NORMAL, sizeof(i2c->client_prio));
+}
+
+/*
+ * A long low class transfer is split at the message boundaries, there
+ * is a stop and a start instead of a repeated start in between. The low
+ * class is for the clients that do not mind, EEPROMs keep their address
+ * pointer for the current address read for example.
+ */
+static void hisi2c_cache_msgs(struct i2c_msg *msgs, int num);
+
+static int hisi2c_doxfer(struct hisi2c_adap *i2c, struct i2c_msg *msgs, int num)
+{
+	int prio = hisi2c_prio(i2c, msgs[0].addr);
+	int rval;
+
+	hisi2c_lock(i2c, prio);
+	if (prio != I2C_PRIO_LOW || num == 1
+			|| hisi2c_xfer_len(msgs, num) <= split_len) {
+		rval = __hisi2c_doxfer(i2c, msgs, num);
+	} else {
+		for (rval = 0; rval < num; rval++) {
+			if (rval)
+				hisi2c_yield(i2c, prio);
+			if (__hisi2c_doxfer(i2c, &msgs[rval], 1) != 1)
+				break;
+		}
+	}
+	/* a failed transfer may have written some, drop them all */
+	hisi2c_cache_msgs(msgs, num);
+	hisi2c_unlock(i2c);
+
 	return rval;
 }
 
@@ -259,15 +629,909 @@ static const struct i2c_algorithm hisi2c_algorithm = {
 	.functionality		= hisi2c_func,
 };
 
+/* ----------------------------------------------------------------- */
+/* register cache for HI_I2C_Read/HI_I2C_Write */
+/* ----------------------------------------------------------------- */
+
+/*
+ * A client of the old API may ask for its registers to be cached, keyed
+ * by the reg value it passes, for accesses of the reglen/len it gave at
+ * HI_I2C_CacheInit. Reads of cacheable registers are served from memory
+ * once the register has been read or written. Registers in a volatile
+ * range, or in no range, always go to the bus.
+ *
+ * Writes go to the bus at once (HI_I2C_CACHE_WRITE_THROUGH), or are only
+ * kept in the cache until HI_I2C_CacheSync (HI_I2C_CACHE_DEFERRED), in
+ * which case their order against uncached writes is not kept.
+ *
+ * Every other write to the client keeps the cache coherent: those of
+ * __hisi2c_write (batches, frame sets) update it, the messages of
+ * master_xfer and CMD_I2C_RDWR drop the registers they may have written,
+ * taken as reg in big endian then data auto-incrementing reg, as
+ * __hisi2c_write puts them. The registers still to be written by
+ * HI_I2C_CacheSync are kept.
+ *
+ * Everything is protected by the adapter mutex.
+ */
+#define HI_I2C_CACHE_WRITE_THROUGH	0
+#define HI_I2C_CACHE_DEFERRED		1
+
+#define HI_I2C_CACHE_MAX_REGS		4096	/* per range */
+
+struct hisi2c_cache_range {
+	struct list_head list;
+	uint first, last;
+	int is_volatile;
+	u32 *val;		/* as HI_I2C_Read returns it */
+	unsigned long *valid;
+	unsigned long *dirty;
+};
+
+struct hisi2c_cache {
+	struct list_head list;
+	u8 addr;
+	uint reglen, len;
+	int mode;
+	struct list_head ranges;
+
+	unsigned long hits;
+	unsigned long misses;
+};
+
+static LIST_HEAD(hisi2c_caches);
+
+/* by the 8-bit address, the R/W bit does not matter */
+static struct hisi2c_cache *hisi2c_cache_find(u8 addr)
+{
+	struct hisi2c_cache *c;
+
+	list_for_each_entry(c, &hisi2c_caches, list)
+		if ((c->addr >> 1) == (addr >> 1))
+			return c;
+
+	return NULL;
+}
+
+/*
+ * The range caching reg of an access, NULL if it is not cached. A
+ * volatile range wins over a cacheable one.
+ */
+static struct hisi2c_cache_range *hisi2c_cache_range(struct hisi2c_cache *c,
+		uint reg, uint reglen, uint len)
+{
+	struct hisi2c_cache_range *r, *found = NULL;
+
+	if (!c || reglen != c->reglen || len != c->len)
+		return NULL;
+
+	list_for_each_entry(r, &c->ranges, list) {
+		if (reg < r->first || reg > r->last)
+			continue;
+		if (r->is_volatile)
+			return NULL;
+		found = r;
+	}
+
+	return found;
+}
+
+/* what HI_I2C_Read returns after data has been written */
+static u32 hisi2c_wire_val(uint data, uint len)
+{
+	u32 val = 0;
+	int i;
+
+	for (i = 0; i < len; i++)
+		val |= ((data >> ((len - i - 1) * 8)) & 0xff) << (i * 8);
+
+	return val;
+}
+
+/* the registers first..first + n - 1 are no longer known */
+static void hisi2c_cache_invalidate(struct hisi2c_cache *c, uint first,
+		uint n)
+{
+	struct hisi2c_cache_range *r;
+	uint i, end, last = first + n - 1;
+
+	if (!n)
+		return;
+	if (last < first)
+		last = UINT_MAX;
+
+	list_for_each_entry(r, &c->ranges, list) {
+		if (r->is_volatile || last < r->first || first > r->last)
+			continue;
+
+		end = min(last, r->last) - r->first;
+		for (i = max(first, r->first) - r->first; i <= end; i++)
+			if (!test_bit(i, r->dirty))
+				clear_bit(i, r->valid);
+	}
+}
+
+/* after a write by __hisi2c_write, ok if it went through */
+static void hisi2c_cache_written(u8 addr, uint reg, uint reglen,
+		uint data, uint len, int ok)
+{
+	struct hisi2c_cache *c = hisi2c_cache_find(addr);
+	struct hisi2c_cache_range *r;
+	uint i;
+
+	if (!c)
+		return;
+
+	r = hisi2c_cache_range(c, reg, reglen, len);
+	if (!r || !ok) {
+		hisi2c_cache_invalidate(c, reg, DIV_ROUND_UP(len, c->len));
+		return;
+	}
+
+	i = reg - r->first;
+	r->val[i] = hisi2c_wire_val(data, len);
+	set_bit(i, r->valid);
+	clear_bit(i, r->dirty);
+}
+
+/* after the messages of a transfer from another API */
+static void hisi2c_cache_msgs(struct i2c_msg *msgs, int num)
+{
+	struct hisi2c_cache *c;
+	uint reg, i;
+	int m;
+
+	for (m = 0; m < num; m++) {
+		struct i2c_msg *msg = &msgs[m];
+
+		if (msg->flags & I2C_M_RD)
+			continue;
+		c = hisi2c_cache_find(msg->addr << 1);
+		if (!c || msg->len <= c->reglen)
+			continue;	/* no data written */
+
+		for (reg = 0, i = 0; i < c->reglen; i++)
+			reg = reg << 8 | msg->buf[i];
+		hisi2c_cache_invalidate(c, reg,
+				DIV_ROUND_UP(msg->len - c->reglen, c->len));
+	}
+}
+
+static void hisi2c_cache_free(struct hisi2c_cache *c)
+{
+	struct hisi2c_cache_range *r, *tmp;
+
+	list_for_each_entry_safe(r, tmp, &c->ranges, list) {
+		list_del(&r->list);
+		kfree(r->val);
+		kfree(r->valid);
+		kfree(r->dirty);
+		kfree(r);
+	}
+
+	list_del(&c->list);
+	kfree(c);
+}
+
+int HI_I2C_CacheInit(u8 addr, uint reglen, uint len, int mode)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	struct hisi2c_cache *c;
+	int rval = 0;
+
+	if (!reglen || reglen > 4 || !len || len > 4
+			|| (mode != HI_I2C_CACHE_WRITE_THROUGH
+				&& mode != HI_I2C_CACHE_DEFERRED))
+		return -EINVAL;
+
+	c = kzalloc(sizeof(*c), GFP_KERNEL);
+	if (!c)
+		return -ENOMEM;
+
+	c->addr = addr;
+	c->reglen = reglen;
+	c->len = len;
+	c->mode = mode;
+	INIT_LIST_HEAD(&c->ranges);
+
+	mutex_lock(&i2c->mutex);
+	if (hisi2c_cache_find(addr))
+		rval = -EBUSY;
+	else
+		list_add_tail(&c->list, &hisi2c_caches);
+	mutex_unlock(&i2c->mutex);
+
+	if (rval)
+		kfree(c);
+
+	return rval;
+}
+
+/* registers first..last, both included */
+int HI_I2C_CacheAddRange(u8 addr, uint first, uint last, int is_volatile)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	struct hisi2c_cache_range *r;
+	struct hisi2c_cache *c;
+	uint n;
+	int rval = 0;
+
+	/* before the + 1, 0..UINT_MAX would wrap to 0 */
+	if (last < first || (!is_volatile
+				&& last - first >= HI_I2C_CACHE_MAX_REGS))
+		return -EINVAL;
+	n = last - first + 1;
+
+	r = kzalloc(sizeof(*r), GFP_KERNEL);
+	if (!r)
+		return -ENOMEM;
+
+	r->first = first;
+	r->last = last;
+	r->is_volatile = is_volatile;
+
+	if (!is_volatile) {
+		r->val = kcalloc(n, sizeof(*r->val), GFP_KERNEL);
+		r->valid = kcalloc(BITS_TO_LONGS(n), sizeof(long), GFP_KERNEL);
+		r->dirty = kcalloc(BITS_TO_LONGS(n), sizeof(long), GFP_KERNEL);
+		if (!r->val || !r->valid || !r->dirty) {
+			rval = -ENOMEM;
+			goto err;
+		}
+	}
+
+	mutex_lock(&i2c->mutex);
+	c = hisi2c_cache_find(addr);
+	if (c)
+		list_add_tail(&r->list, &c->ranges);
+	mutex_unlock(&i2c->mutex);
+
+	if (c)
+		return 0;
+	rval = -ENODEV;
+
+err:
+	kfree(r->val);
+	kfree(r->valid);
+	kfree(r->dirty);
+	kfree(r);
+	return rval;
+}
+
+static int __hisi2c_write(u8 addr, uint reg, uint reglen, uint data, uint len);
+
+/* write the dirty registers of c in register order */
+static int __hisi2c_cache_sync(struct hisi2c_cache *c)
+{
+	struct hisi2c_cache_range *r;
+	int rval = 0;
+	uint i, n;
+
+	list_for_each_entry(r, &c->ranges, list) {
+		if (r->is_volatile)
+			continue;
+
+		n = r->last - r->first + 1;
+		for_each_set_bit(i, r->dirty, n) {
+			u32 val = r->val[i];
+			uint data = 0;
+			int b;
+
+			/* back from the HI_I2C_Read layout */
+			for (b = 0; b < c->len; b++)
+				data |= ((val >> (b * 8)) & 0xff)
+					<< ((c->len - b - 1) * 8);
+
+			if (__hisi2c_write(c->addr, r->first + i, c->reglen,
+						data, c->len) != 1) {
+				rval = -EREMOTEIO;
+				continue;	/* stays dirty */
+			}
+			clear_bit(i, r->dirty);
+		}
+	}
+
+	return rval;
+}
+
+int HI_I2C_CacheSync(u8 addr)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	struct hisi2c_cache *c;
+	int rval = -ENODEV;
+
+	hisi2c_lock(i2c, hisi2c_prio(i2c, addr >> 1));
+	c = hisi2c_cache_find(addr);
+	if (c)
+		rval = __hisi2c_cache_sync(c);
+	hisi2c_unlock(i2c);
+
+	return rval;
+}
+
+/* forget what is cached, the next reads go to the bus */
+int HI_I2C_CacheDrop(u8 addr)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	struct hisi2c_cache_range *r;
+	struct hisi2c_cache *c;
+
+	mutex_lock(&i2c->mutex);
+	c = hisi2c_cache_find(addr);
+	if (c) {
+		list_for_each_entry(r, &c->ranges, list) {
+			uint n = r->last - r->first + 1;
+
+			if (r->is_volatile)
+				continue;
+			bitmap_zero(r->valid, n);
+			bitmap_zero(r->dirty, n);
+		}
+	}
+	mutex_unlock(&i2c->mutex);
+
+	return c ? 0 : -ENODEV;
+}
+
+/* dirty registers are written before the cache goes */
+void HI_I2C_CacheExit(u8 addr)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	struct hisi2c_cache *c;
+
+	hisi2c_lock(i2c, hisi2c_prio(i2c, addr >> 1));
+	c = hisi2c_cache_find(addr);
+	if (c) {
+		__hisi2c_cache_sync(c);
+		hisi2c_cache_free(c);
+	}
+	hisi2c_unlock(i2c);
+}
+
+EXPORT_SYMBOL(HI_I2C_CacheInit);
+EXPORT_SYMBOL(HI_I2C_CacheAddRange);
+EXPORT_SYMBOL(HI_I2C_CacheSync);
+EXPORT_SYMBOL(HI_I2C_CacheDrop);
+EXPORT_SYMBOL(HI_I2C_CacheExit);
+
+/* ----------------------------------------------------------------- */
+/* per frame register sets */
+/* ----------------------------------------------------------------- */
+
+/*
+ * HI_I2C_FrameWrite stages a register write without touching the bus,
+ * a later write of the same register replaces the staged one. On the
+ * edge of vsync_gpio the staged set is swapped with the empty flush set
+ * in the hard IRQ and written by the IRQ thread, so that all of it lands
+ * in the blanking. If the previous set is still being written at the
+ * edge, the staged one waits for the next edge and is counted as an
+ * overrun. Nothing is flushed without vsync_gpio/vsync_irq.
+ *
+ * The edge IRQ of the GPIO is handled by his_gpio, its helpers are looked
+ * up when vsync_gpio is given, so that the driver does not need his_gpio
+ * otherwise. It has to be loaded first then.
+ */
+static int vsync_gpio = -1;
+module_param(vsync_gpio, int, 0444);
+MODULE_PARM_DESC(vsync_gpio, "GPIO whose edge flushes the frame set (-1: none)");
+
+static int vsync_irq = -1;
+module_param(vsync_irq, int, 0444);
+MODULE_PARM_DESC(vsync_irq, "IRQ of the bank of vsync_gpio");
+
+static int vsync_rising = 1;
+module_param(vsync_rising, int, 0444);
+MODULE_PARM_DESC(vsync_rising, "Flush on the rising edge (1) or falling (0)");
+
+static struct hisi2c_vsync_ops {
+	typeof(&his_gpio_irq_enable) enable;
+	typeof(&his_gpio_irq_disable) disable;
+	typeof(&his_gpio_irq_pending) pending;
+	typeof(&his_gpio_irq_ack) ack;
+} vsync_ops;
+
+#define I2C_FRAME_REGS	64
+
+struct hisi2c_frame_reg {
+	u8 addr;
+	u8 reglen;
+	u8 len;
+	uint reg;
+	uint data;
+};
+
+struct hisi2c_frame_set {
+	struct hisi2c_frame_reg regs[I2C_FRAME_REGS];
+	int num;
+};
+
+static struct hisi2c_frame {
+	spinlock_t lock;
+	struct hisi2c_frame_set set[2];
+	struct hisi2c_frame_set *staged;
+	struct hisi2c_frame_set *flush;
+	int flushing;
+	ktime_t edge;
+
+	struct hisi2c_frame_stats {
+		unsigned long frames;	/* sets written */
+		unsigned long regs;	/* registers written */
+		unsigned long errors;
+		unsigned long overruns;
+		unsigned long dropped;	/* staged to a full set */
+		u32 lat_last, lat_max;	/* edge to the end of the flush, us */
+		u32 dur_last, dur_max;	/* length of the flush, us */
+	} st;
+} hisi2c_frame;
+
+int HI_I2C_FrameWrite(u8 addr, uint reg, uint reglen, uint data, uint len)
+{
+	struct hisi2c_frame *f = &hisi2c_frame;
+	struct hisi2c_frame_set *set;
+	unsigned long flags;
+	int i, rval = 0;
+
+	if (reglen > 4 || len > 4)
+		return -EINVAL;
+
+	spin_lock_irqsave(&f->lock, flags);
+	set = f->staged;
+	for (i = 0; i < set->num; i++) {
+		if (set->regs[i].addr == addr && set->regs[i].reg == reg)
+			break;
+	}
+
+	if (i == I2C_FRAME_REGS) {
+		f->st.dropped++;
+		rval = -ENOSPC;
+	} else {
+		set->regs[i].addr = addr;
+		set->regs[i].reg = reg;
+		set->regs[i].reglen = reglen;
+		set->regs[i].data = data;
+		set->regs[i].len = len;
+		if (i == set->num)
+			set->num++;
+	}
+	spin_unlock_irqrestore(&f->lock, flags);
+
+	return rval;
+}
+EXPORT_SYMBOL(HI_I2C_FrameWrite);
+
+static irqreturn_t hisi2c_vsync_irq(int irq, void *dev_id)
+{
+	struct hisi2c_frame *f = &hisi2c_frame;
+	struct hisi2c_frame_set *set;
+	irqreturn_t rval = IRQ_HANDLED;
+
+	if (!vsync_ops.pending(vsync_gpio))
+		return IRQ_NONE;
+	vsync_ops.ack(vsync_gpio);
+
+	spin_lock(&f->lock);
+	if (f->flushing) {
+		if (f->staged->num)
+			f->st.overruns++;
+	} else if (f->staged->num) {
+		set = f->flush;
+		f->flush = f->staged;
+		f->staged = set;
+		f->staged->num = 0;
+		f->flushing = 1;
+		f->edge = ktime_get();
+		rval = IRQ_WAKE_THREAD;
+	}
+	spin_unlock(&f->lock);
+
+	return rval;
+}
+
+static irqreturn_t hisi2c_vsync_thread(int irq, void *dev_id)
+{
+	struct hisi2c_adap *i2c = dev_id;
+	struct hisi2c_frame *f = &hisi2c_frame;
+	struct hisi2c_frame_set *set = f->flush;
+	ktime_t start, end;
+	u32 us;
+	int i;
+
+	/* the set is due at the next frame, whoever the clients are */
+	start = ktime_get();
+	hisi2c_lock(i2c, I2C_PRIO_HIGH);
+	for (i = 0; i < set->num; i++) {
+		struct hisi2c_frame_reg *r = &set->regs[i];
+
+		if (__hisi2c_write(r->addr, r->reg, r->reglen,
+					r->data, r->len) != 1)
+			f->st.errors++;
+	}
+	hisi2c_unlock(i2c);
+	end = ktime_get();
+
+	spin_lock_irq(&f->lock);
+	f->st.frames++;
+	f->st.regs += set->num;
+	set->num = 0;
+	f->flushing = 0;
+
+	us = ktime_to_us(ktime_sub(end, start));
+	f->st.dur_last = us;
+	f->st.dur_max = max(f->st.dur_max, us);
+	us = ktime_to_us(ktime_sub(end, f->edge));
+	f->st.lat_last = us;
+	f->st.lat_max = max(f->st.lat_max, us);
+	spin_unlock_irq(&f->lock);
+
+	return IRQ_HANDLED;
+}
+
+static void hisi2c_vsync_put(void)
+{
+	if (vsync_ops.enable)
+		symbol_put(his_gpio_irq_enable);
+	if (vsync_ops.disable)
+		symbol_put(his_gpio_irq_disable);
+	if (vsync_ops.pending)
+		symbol_put(his_gpio_irq_pending);
+	if (vsync_ops.ack)
+		symbol_put(his_gpio_irq_ack);
+	memset(&vsync_ops, 0, sizeof(vsync_ops));
+}
+
+static int hisi2c_vsync_get(void)
+{
+	vsync_ops.enable = symbol_get(his_gpio_irq_enable);
+	vsync_ops.disable = symbol_get(his_gpio_irq_disable);
+	vsync_ops.pending = symbol_get(his_gpio_irq_pending);
+	vsync_ops.ack = symbol_get(his_gpio_irq_ack);
+	if (!vsync_ops.enable || !vsync_ops.disable
+			|| !vsync_ops.pending || !vsync_ops.ack) {
+		pr_err("hisi2c: vsync_gpio needs his_gpio loaded\n");
+		hisi2c_vsync_put();
+		return -ENODEV;
+	}
+
+	return 0;
+}
+
+static int hisi2c_frame_init(struct hisi2c_adap *i2c)
+{
+	struct hisi2c_frame *f = &hisi2c_frame;
+	int rval;
+
+	spin_lock_init(&f->lock);
+	f->staged = &f->set[0];
+	f->flush = &f->set[1];
+
+	if (vsync_gpio < 0 || vsync_irq < 0)
+		return 0;
+
+	rval = hisi2c_vsync_get();
+	if (rval)
+		return rval;
+
+	rval = gpio_request(vsync_gpio, "hisi2c-vsync");
+	if (rval) {
+		pr_err("hisi2c: GPIO %d is used\n", vsync_gpio);
+		hisi2c_vsync_put();
+		return rval;
+	}
+	gpio_direction_input(vsync_gpio);
+
+	rval = request_threaded_irq(vsync_irq, hisi2c_vsync_irq,
+			hisi2c_vsync_thread, IRQF_SHARED, "hisi2c-vsync", i2c);
+	if (rval) {
+		pr_err("hisi2c: cannot claim IRQ %d\n", vsync_irq);
+		gpio_free(vsync_gpio);
+		hisi2c_vsync_put();
+		return rval;
+	}
+
+	rval = vsync_ops.enable(vsync_gpio, vsync_rising);
+	if (rval) {
+		free_irq(vsync_irq, i2c);
+		gpio_free(vsync_gpio);
+		hisi2c_vsync_put();
+	}
+
+	return rval;
+}
+
+static void hisi2c_frame_exit(struct hisi2c_adap *i2c)
+{
+	if (vsync_gpio < 0 || vsync_irq < 0)
+		return;
+
+	vsync_ops.disable(vsync_gpio);
+	free_irq(vsync_irq, i2c);
+	gpio_free(vsync_gpio);
+	hisi2c_vsync_put();
+}
+
+static ssize_t hisi2c_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+
+	return sprintf(buf, "irq %lu\npoll %lu\n", i2c->nr_irq, i2c->nr_poll);
+}
+
+static DEVICE_ATTR(xfer_stats, S_IRUGO, hisi2c_stats_show, NULL);
+
+/* "<us irq poll" per line, from the start to the stop of the transfer */
+static ssize_t hisi2c_lat_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	ssize_t len = 0;
+	int n;
+
+	for (n = 0; n < I2C_LAT_BUCKETS; n++) {
+		if (n == I2C_LAT_BUCKETS - 1)
+			len += sprintf(buf + len, ">=%-6u", 1 << (n - 1));
+		else
+			len += sprintf(buf + len, "<%-7u", 1 << n);
+		len += sprintf(buf + len, " %8lu %8lu\n",
+				i2c->lat_hist[0][n], i2c->lat_hist[1][n]);
+	}
+
+	return len;
+}
+
+/* write anything to clear it */
+static ssize_t hisi2c_lat_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+
+	mutex_lock(&i2c->mutex);
+	memset(i2c->lat_hist, 0, sizeof(i2c->lat_hist));
+	mutex_unlock(&i2c->mutex);
+
+	return count;
+}
+
+static DEVICE_ATTR(latency_hist, S_IRUGO | S_IWUSR,
+		hisi2c_lat_show, hisi2c_lat_store);
+
+/* the SCL rate of the clients not in client_speed */
+static ssize_t hisi2c_speed_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", hisi2c_adap.speed);
+}
+
+static ssize_t hisi2c_speed_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	unsigned long rate;
+
+	if (strict_strtoul(buf, 0, &rate) || !hisi2c_valid_speed(rate))
+		return -EINVAL;
+
+	mutex_lock(&i2c->mutex);
+	i2c->speed = rate;
+	mutex_unlock(&i2c->mutex);
+
+	return count;
+}
+
+static DEVICE_ATTR(speed, S_IRUGO | S_IWUSR,
+		hisi2c_speed_show, hisi2c_speed_store);
+
+/*
+ * "addr rate" sets the SCL rate of the 7-bit client address, rate 0
+ * goes back to the default speed. Reading lists the addresses set.
+ */
+static ssize_t hisi2c_client_speed_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	ssize_t len = 0;
+	int addr;
+
+	for (addr = 0; addr < ARRAY_SIZE(i2c->client_speed); addr++) {
+		if (i2c->client_speed[addr])
+			len += sprintf(buf + len, "0x%02x %u\n",
+					addr, i2c->client_speed[addr]);
+	}
+
+	return len;
+}
+
+static ssize_t hisi2c_client_speed_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	unsigned int addr, rate;
+
+	if (sscanf(buf, "%i %u", &addr, &rate) != 2)
+		return -EINVAL;
+	if (addr >= ARRAY_SIZE(i2c->client_speed)
+			|| (rate && !hisi2c_valid_speed(rate)))
+		return -EINVAL;
+
+	mutex_lock(&i2c->mutex);
+	i2c->client_speed[addr] = rate;
+	mutex_unlock(&i2c->mutex);
+
+	return count;
+}
+
+static DEVICE_ATTR(client_speed, S_IRUGO | S_IWUSR,
+		hisi2c_client_speed_show, hisi2c_client_speed_store);
+
+static const char *hisi2c_prio_names[I2C_PRIO_NR] = {"high", "normal", "low"};
+
+/*
+ * "addr high|normal|low" sets the scheduling class of the 7-bit client
+ * address, all are normal at first. Reading lists the others.
+ */
+static ssize_t hisi2c_client_prio_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	ssize_t len = 0;
+	int addr;
+
+	for (addr = 0; addr < ARRAY_SIZE(i2c->client_prio); addr++) {
+		if (i2c->client_prio[addr] != I2C_PRIO_NORMAL)
+			len += sprintf(buf + len, "0x%02x %s\n", addr,
+				hisi2c_prio_names[i2c->client_prio[addr]]);
+	}
+
+	return len;
+}
+
+static ssize_t hisi2c_client_prio_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	unsigned int addr;
+	char name[8];
+	int prio;
+
+	if (sscanf(buf, "%i %7s", &addr, name) != 2)
+		return -EINVAL;
+	if (addr >= ARRAY_SIZE(i2c->client_prio))
+		return -EINVAL;
+
+	for (prio = 0; prio < I2C_PRIO_NR; prio++) {
+		if (!strcmp(name, hisi2c_prio_names[prio]))
+			break;
+	}
+	if (prio == I2C_PRIO_NR)
+		return -EINVAL;
+
+	i2c->client_prio[addr] = prio;
+
+	return count;
+}
+
+static DEVICE_ATTR(client_prio, S_IRUGO | S_IWUSR,
+		hisi2c_client_prio_show, hisi2c_client_prio_store);
+
+/* one line per class: grants waiting splits wait_avg wait_max, in us */
+static ssize_t hisi2c_sched_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct hisi2c_sched *s = &hisi2c_adap.sched;
+	struct hisi2c_sched_stats st[I2C_PRIO_NR];
+	unsigned int waiting[I2C_PRIO_NR];
+	ssize_t len = 0;
+	int c;
+
+	spin_lock(&s->lock);
+	memcpy(st, s->st, sizeof(st));
+	for (c = 0; c < I2C_PRIO_NR; c++)
+		waiting[c] = s->next[c] - s->serving[c];
+	spin_unlock(&s->lock);
+
+	for (c = 0; c < I2C_PRIO_NR; c++) {
+		u64 avg = st[c].wait_sum;
+
+		if (st[c].nr)
+			do_div(avg, st[c].nr);
+		len += sprintf(buf + len, "%-6s %lu %u %lu %llu %u\n",
+				hisi2c_prio_names[c], st[c].nr, waiting[c],
+				st[c].splits, avg, st[c].wait_max);
+	}
+
+	return len;
+}
+
+/* write anything to clear it */
+static ssize_t hisi2c_sched_stats_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct hisi2c_sched *s = &hisi2c_adap.sched;
+
+	spin_lock(&s->lock);
+	memset(s->st, 0, sizeof(s->st));
+	spin_unlock(&s->lock);
+
+	return count;
+}
+
+static DEVICE_ATTR(sched_stats, S_IRUGO | S_IWUSR,
+		hisi2c_sched_stats_show, hisi2c_sched_stats_store);
+
+/* one line per cached client: addr hits misses dirty */
+static ssize_t hisi2c_reg_cache_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	struct hisi2c_cache_range *r;
+	struct hisi2c_cache *c;
+	ssize_t len = 0;
+
+	mutex_lock(&i2c->mutex);
+	list_for_each_entry(c, &hisi2c_caches, list) {
+		int dirty = 0;
+
+		list_for_each_entry(r, &c->ranges, list)
+			if (!r->is_volatile)
+				dirty += bitmap_weight(r->dirty,
+						r->last - r->first + 1);
+
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				"0x%02x %lu %lu %d\n", c->addr,
+				c->hits, c->misses, dirty);
+	}
+	mutex_unlock(&i2c->mutex);
+
+	return len;
+}
+
+static DEVICE_ATTR(reg_cache, S_IRUGO, hisi2c_reg_cache_show, NULL);
+
+static ssize_t hisi2c_frame_stats_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct hisi2c_frame *f = &hisi2c_frame;
+	struct hisi2c_frame_stats f_copy;
+
+	spin_lock_irq(&f->lock);
+	f_copy = f->st;
+	spin_unlock_irq(&f->lock);
+
+	return sprintf(buf, "frames %lu\nregs %lu\nerrors %lu\n"
+			"overruns %lu\ndropped %lu\n"
+			"latency_us %u (max %u)\nflush_us %u (max %u)\n",
+			f_copy.frames, f_copy.regs, f_copy.errors,
+			f_copy.overruns, f_copy.dropped,
+			f_copy.lat_last, f_copy.lat_max,
+			f_copy.dur_last, f_copy.dur_max);
+}
+
+static DEVICE_ATTR(frame_stats, S_IRUGO, hisi2c_frame_stats_show, NULL);
+
+static struct attribute *hisi2c_attrs[] = {
+	&dev_attr_xfer_stats.attr,
+	&dev_attr_latency_hist.attr,
+	&dev_attr_speed.attr,
+	&dev_attr_client_speed.attr,
+	&dev_attr_client_prio.attr,
+	&dev_attr_sched_stats.attr,
+	&dev_attr_reg_cache.attr,
+	&dev_attr_frame_stats.attr,
+	NULL
+};
+
+static const struct attribute_group hisi2c_attr_group = {
+	.attrs = hisi2c_attrs,
+};
+
 
 /* ----------------------------------------------------------------- */
 /* this is for drivers using api of old i2c driver from hisi */
 /* code may be confusing, but it really is what the old code is */
 /* ----------------------------------------------------------------- */
-int HI_I2C_Write(u8 addr, uint reg, uint reglen, uint data, uint len)
+/* returns the number of msgs done, 1 on success */
+static int __hisi2c_write(u8 addr, uint reg, uint reglen, uint data, uint len)
 {
-	struct i2c_adapter *adap = &hisi2c_adap.adap;
-	u8 buf[reglen + len];
+	u8 buf[8];
 	int i;
 
 	struct i2c_msg msg = {
@@ -283,13 +1547,46 @@ int HI_I2C_Write(u8 addr, uint reg, uint reglen, uint data, uint len)
 	for (i = 0; i < len; i++)
 		buf[reglen + i] = data >> ((len - i - 1) * 8);
 
-	hisi2c_xfer(adap, &msg, 1);
+	i = __hisi2c_doxfer(&hisi2c_adap, &msg, 1);
+	hisi2c_cache_written(addr, reg, reglen, data, len, i == 1);
+
+	return i;
+}
+
+int HI_I2C_Write(u8 addr, uint reg, uint reglen, uint data, uint len)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	struct hisi2c_cache *c;
+	struct hisi2c_cache_range *r;
+
+	if (reglen > 4 || len > 4)
+		return -EINVAL;
+
+	hisi2c_lock(i2c, hisi2c_prio(i2c, addr >> 1));
+	c = hisi2c_cache_find(addr);
+	r = hisi2c_cache_range(c, reg, reglen, len);
+	if (r && c->mode == HI_I2C_CACHE_DEFERRED) {
+		uint i = reg - r->first;
+
+		r->val[i] = hisi2c_wire_val(data, len);
+		set_bit(i, r->valid);
+		set_bit(i, r->dirty);
+		goto out;
+	}
+
+	/* the cache is updated there */
+	__hisi2c_write(addr, reg, reglen, data, len);
+out:
+	hisi2c_unlock(i2c);
+
 	return 0;
 }
 
 int HI_I2C_Read(u8 addr, uint reg, uint reglen, uint len)
 {
-	struct i2c_adapter *adap = &hisi2c_adap.adap;
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	struct hisi2c_cache *c;
+	struct hisi2c_cache_range *r;
 	unsigned int val = 0;
 
 	struct i2c_msg msgs[2] = {
@@ -307,7 +1604,23 @@ int HI_I2C_Read(u8 addr, uint reg, uint reglen, uint len)
 		}
 	};
 
-	hisi2c_xfer(adap, msgs, 2);
+	hisi2c_lock(i2c, hisi2c_prio(i2c, addr >> 1));
+	c = hisi2c_cache_find(addr);
+	r = hisi2c_cache_range(c, reg, reglen, len);
+	if (r && test_bit(reg - r->first, r->valid)) {
+		c->hits++;
+		val = r->val[reg - r->first];
+		goto out;
+	}
+
+	if (__hisi2c_doxfer(i2c, msgs, 2) == 2 && r) {
+		r->val[reg - r->first] = val;
+		set_bit(reg - r->first, r->valid);
+	}
+	if (r)
+		c->misses++;
+out:
+	hisi2c_unlock(i2c);
 	return val;
 }
 
@@ -324,6 +1637,94 @@ typedef struct I2C_DATA {
 
 #define CMD_I2C_WRITE 0x01
 #define CMD_I2C_READ 0x03
+#define CMD_I2C_BATCH 0x05
+#define CMD_I2C_RDWR 0x07
+#define CMD_I2C_FRAME_WRITE 0x09	/* I2C_DATA_S, see HI_I2C_FrameWrite */
+
+/*
+ * CMD_I2C_BATCH writes num entries, a sensor init table for example,
+ * while holding the bus. delay_us, up to 100ms, is waited after the
+ * entry. On error,
+ * failed_index tells the first entry that failed, it is -1 otherwise.
+ */
+typedef struct I2C_BATCH_ENTRY {
+	unsigned char addr;
+	unsigned int reg;
+	unsigned int reglen;
+	unsigned int data;
+	unsigned int len;
+	unsigned int delay_us;
+} I2C_BATCH_ENTRY_S;
+
+typedef struct I2C_BATCH {
+	I2C_BATCH_ENTRY_S __user *entries;
+	unsigned int num;
+	int failed_index;
+} I2C_BATCH_S;
+
+#define I2C_BATCH_MAX	4096
+#define I2C_BATCH_MAX_DELAY	100000	/* us, the bus is held meanwhile */
+#define I2C_BATCH_CHUNK	32	/* entries copied from user at once */
+
+static int hisi2c_batch(I2C_BATCH_S __user *arg)
+{
+	struct hisi2c_adap *i2c = &hisi2c_adap;
+	I2C_BATCH_ENTRY_S ent[I2C_BATCH_CHUNK];
+	I2C_BATCH_S batch;
+	unsigned int i, n;
+	unsigned char addr = 0;
+	int rval = 0;
+
+	if (copy_from_user(&batch, arg, sizeof(batch)))
+		return -EFAULT;
+	if (batch.num > I2C_BATCH_MAX)
+		return -EINVAL;
+	/* the batch runs in the class of its first client */
+	if (batch.num && get_user(addr, &batch.entries[0].addr))
+		return -EFAULT;
+
+	batch.failed_index = -1;
+
+	hisi2c_lock(i2c, hisi2c_prio(i2c, addr >> 1));
+	for (i = 0; i < batch.num && !rval; i++) {
+		I2C_BATCH_ENTRY_S *e = &ent[i % I2C_BATCH_CHUNK];
+
+		if (!(i % I2C_BATCH_CHUNK)) {
+			n = min(batch.num - i, (unsigned int)I2C_BATCH_CHUNK);
+			if (copy_from_user(ent, batch.entries + i,
+						n * sizeof(*ent))) {
+				rval = -EFAULT;
+				break;
+			}
+		}
+
+		if (e->reglen > 4 || e->len > 4
+				|| e->delay_us > I2C_BATCH_MAX_DELAY)
+			rval = -EINVAL;
+		else if (__hisi2c_write(e->addr, e->reg, e->reglen,
+					e->data, e->len) != 1)
+			rval = -EREMOTEIO;
+
+		if (rval) {
+			batch.failed_index = i;
+			break;
+		}
+
+		if (e->delay_us > 20000)
+			msleep(DIV_ROUND_UP(e->delay_us, 1000));
+		else if (e->delay_us > 10)
+			usleep_range(e->delay_us, e->delay_us + e->delay_us / 8);
+		else if (e->delay_us)
+			udelay(e->delay_us);
+	}
+	hisi2c_unlock(i2c);
+
+	if (copy_to_user(&arg->failed_index, &batch.failed_index,
+				sizeof(batch.failed_index)))
+		return -EFAULT;
+
+	return rval;
+}
 
 static int hisi2c_open(struct inode * inode, struct file * file)
 {
@@ -335,10 +1736,91 @@ static int  hisi2c_close(struct inode * inode, struct file * file)
 	return 0;
 }
 
+/*
+ * CMD_I2C_RDWR takes a struct i2c_rdwr_ioctl_data as I2C_RDWR of i2c-dev
+ * does: the messages are one combined transfer with repeated starts.
+ * The addresses are 7-bit here, unlike the rest of this interface.
+ * Returns the number of messages done.
+ */
+#define I2C_RDWR_MAX_LEN	8192
+
+static int hisi2c_rdwr(struct i2c_rdwr_ioctl_data __user *arg)
+{
+	struct i2c_rdwr_ioctl_data rdwr;
+	struct i2c_msg *msgs;
+	u8 __user **ubufs;
+	int i, done, rval = 0;
+
+	if (copy_from_user(&rdwr, arg, sizeof(rdwr)))
+		return -EFAULT;
+	if (!rdwr.nmsgs || rdwr.nmsgs > I2C_RDRW_IOCTL_MAX_MSGS)
+		return -EINVAL;
+
+	msgs = kmalloc(rdwr.nmsgs * sizeof(*msgs), GFP_KERNEL);
+	ubufs = kzalloc(rdwr.nmsgs * sizeof(*ubufs), GFP_KERNEL);
+	if (!msgs || !ubufs) {
+		rval = -ENOMEM;
+		goto out;
+	}
+
+	if (copy_from_user(msgs, rdwr.msgs, rdwr.nmsgs * sizeof(*msgs))) {
+		rval = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < rdwr.nmsgs; i++) {
+		if (msgs[i].len > I2C_RDWR_MAX_LEN
+				|| msgs[i].flags & (I2C_M_TEN | I2C_M_RECV_LEN)) {
+			rval = -EINVAL;
+			break;
+		}
+
+		ubufs[i] = (u8 __user *)msgs[i].buf;
+		msgs[i].buf = kmalloc(msgs[i].len ? msgs[i].len : 1,
+				GFP_KERNEL);
+		if (!msgs[i].buf) {
+			rval = -ENOMEM;
+			break;
+		}
+
+		if (!(msgs[i].flags & I2C_M_RD) && copy_from_user(msgs[i].buf,
+					ubufs[i], msgs[i].len)) {
+			kfree(msgs[i].buf);
+			rval = -EFAULT;
+			break;
+		}
+	}
+
+	if (!rval) {
+		rval = hisi2c_doxfer(&hisi2c_adap, msgs, rdwr.nmsgs);
+		if (rval <= 0)
+			rval = -EREMOTEIO;
+	}
+
+	/* i is the number of buffers allocated, rval of them are done */
+	done = rval;
+	while (i--) {
+		if (i < done && msgs[i].flags & I2C_M_RD && copy_to_user(
+					ubufs[i], msgs[i].buf, msgs[i].len))
+			rval = -EFAULT;
+		kfree(msgs[i].buf);
+	}
+
+out:
+	kfree(ubufs);
+	kfree(msgs);
+	return rval;
+}
+
 static long hisi2c_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	I2C_DATA_S msg;
 
+	if (cmd == CMD_I2C_BATCH)
+		return hisi2c_batch((I2C_BATCH_S __user *)arg);
+	else if (cmd == CMD_I2C_RDWR)
+		return hisi2c_rdwr((struct i2c_rdwr_ioctl_data __user *)arg);
+
 	if (copy_from_user(&msg, (I2C_DATA_S __user *)arg, sizeof(msg))) {
         	pr_err("%s: failed to copy data from user.\n", __func__);
 		return -EFAULT;
@@ -348,6 +1830,10 @@ static long hisi2c_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		return HI_I2C_Write(msg.addr, msg.reg,
 				msg.reglen, msg.data, msg.len);
 
+	} else if (cmd == CMD_I2C_FRAME_WRITE) {
+		return HI_I2C_FrameWrite(msg.addr, msg.reg,
+				msg.reglen, msg.data, msg.len);
+
 	} else if (cmd == CMD_I2C_READ) {
 		msg.data = HI_I2C_Read(msg.addr, msg.reg, msg.reglen, msg.len);
 		if (copy_to_user((I2C_DATA_S __user *)arg, &msg, sizeof(msg))) {
@@ -390,6 +1876,7 @@ static int __init hisi2c_module_init(void)
 
 	mutex_init(&i2c->mutex);
 	init_waitqueue_head(&i2c->wait);
+	hisi2c_sched_init(i2c);
 
 	i2c->regs = ioremap_nocache(I2C_REG_BASE, 0x10000);
 	if (i2c->regs == NULL) {
@@ -397,7 +1884,15 @@ static int __init hisi2c_module_init(void)
 		return -ENXIO;
 	}
 
-	hisi2c_set_clk(i2c, 100 * 1000); /* default to 100k HZ */
+	if (!hisi2c_valid_speed(bus_speed)) {
+		pr_warning("hisi2c: bad bus_speed %d, using 100k\n", bus_speed);
+		bus_speed = I2C_SPEED_STD;
+	}
+
+	i2c->apb_clk = hisi2c_apb_clk();
+	i2c->speed = bus_speed;
+	hisi2c_set_dividers(i2c, i2c->speed);
+	hisi2c_hw_init(i2c);
 
 	i2c->irq = I2C_IRQNO;
 	rval = request_irq(i2c->irq, hisi2c_irq, IRQF_DISABLED, "hisi2c", i2c);
@@ -418,8 +1913,18 @@ static int __init hisi2c_module_init(void)
 		goto err_dev;
 	}
 
+	rval = hisi2c_frame_init(i2c);
+	if (rval)
+		goto err_frame;
+
+	if (sysfs_create_group(&i2c->adap.dev.kobj, &hisi2c_attr_group))
+		pr_warning("hisi2c: no sysfs attributes\n");
+
 	return 0;
 
+err_frame:
+	misc_deregister(&hisi2c_dev);
+
 err_dev:
 	i2c_del_adapter(&i2c->adap);
 
@@ -435,6 +1940,12 @@ static void __exit hisi2c_module_exit(void)
 {
 	struct hisi2c_adap *i2c = &hisi2c_adap;
 
+	while (!list_empty(&hisi2c_caches))
+		hisi2c_cache_free(list_first_entry(&hisi2c_caches,
+					struct hisi2c_cache, list));
+
+	sysfs_remove_group(&i2c->adap.dev.kobj, &hisi2c_attr_group);
+	hisi2c_frame_exit(i2c);
 	misc_deregister(&hisi2c_dev);
 	i2c_del_adapter(&i2c->adap);
 	free_irq(i2c->irq, i2c);
@@ -0,0 +1,32 @@
+/* -- H -- ~ @ ~
+ *
+ * Copyright (c) 2013, Beijing Hanbang Technology, Inc.
+ * John Lee <furious_tauren@163.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/* Put this file in your mach/include/mach directory */
+#ifndef __ARCH_HIS_DS28E10_TAG_H
+#define __ARCH_HIS_DS28E10_TAG_H
+
+#include <linux/types.h>
+
+/* CONFIG_DS28E10_TAG_VAL of u-boot */
+#define ATAG_DS28E10	0x64733238
+
+/* the ds28e10 authentication done by u-boot, same as its tag_ds28e10 */
+struct tag_ds28e10 {
+	s32 status;	/* 0: authenticated */
+	u8 romid[8];	/* valid if romid_ok */
+	u8 otp[4];	/* valid if status is 0 */
+	u32 romid_ok;
+};
+
+/* NULL if u-boot did not pass one */
+extern const struct tag_ds28e10 *hi_ds28e10_boot_tag;
+
+#endif
@@ -16,6 +16,12 @@
 #include <linux/io.h>
 
 #define GPIO_DIR_OFF	0x400
+#define GPIO_IS_OFF	0x404	/* 0: edge */
+#define GPIO_IBE_OFF	0x408	/* 1: both edges */
+#define GPIO_IEV_OFF	0x40C	/* 1: rising */
+#define GPIO_IE_OFF	0x410
+#define GPIO_MIS_OFF	0x418
+#define GPIO_IC_OFF	0x41C
 
 #define GPIO_CHIPSIZE	0x8
 #define GPIO_INSTANCES	0xC
@@ -50,5 +56,51 @@ static inline int gpio_to_irq(unsigned gpio)
 	return __gpio_to_irq(gpio);
 }
 
+/*
+ * Fast path for bit-banged protocols. his_gpio_fast_request resolves the
+ * registers of a pin once, the helpers below are then single MMIO
+ * accesses without gpiolib and without the lock of the bank. The data
+ * register is addressed through PADDR[9:2] so only the pin is touched.
+ *
+ * The direction change is a read-modify-write of GPIO_DIR_OFF shared by
+ * the 8 pins of the bank. It is only safe with IRQs off, or when nothing
+ * else changes the direction of the bank meanwhile; the SoC has one core.
+ */
+struct his_gpio_fast {
+	void __iomem *data;
+	void __iomem *dir;
+	u32 mask;
+};
+
+int his_gpio_fast_request(unsigned gpio, struct his_gpio_fast *fast);
+
+/* drive the pin low */
+static inline void his_gpio_fast_pulldown(struct his_gpio_fast *fast)
+{
+	__raw_writel(0, fast->data);
+	__raw_writel(__raw_readl(fast->dir) | fast->mask, fast->dir);
+}
+
+/* make it an input */
+static inline void his_gpio_fast_release(struct his_gpio_fast *fast)
+{
+	__raw_writel(__raw_readl(fast->dir) & ~fast->mask, fast->dir);
+}
+
+static inline int his_gpio_fast_sample(struct his_gpio_fast *fast)
+{
+	return __raw_readl(fast->data) ? 1 : 0;
+}
+
+/*
+ * Edge interrupts of a pin, for drivers requesting the IRQ of the bank
+ * themselves. The IRQ may be shared by several banks, so the handler
+ * checks his_gpio_irq_pending and acks with his_gpio_irq_ack.
+ */
+int his_gpio_irq_enable(unsigned gpio, int rising);
+void his_gpio_irq_disable(unsigned gpio);
+int his_gpio_irq_pending(unsigned gpio);
+void his_gpio_irq_ack(unsigned gpio);
+
 #endif
 
@@ -0,0 +1,40 @@
+/* -- C -- ~ @ ~
+ *
+ * Copyright (c) 2013, Beijing Hanbang Technology, Inc.
+ * John Lee <furious_tauren@163.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Keep the ds28e10 result u-boot passes in ATAG_DS28E10 for the ds28e10
+ * module. Tags are parsed before any module is loaded, so this has to
+ * be built in; kernel/Makefile puts it into arch/arm/mach-hi3518.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <asm/setup.h>
+#include <mach/ds28e10_tag.h>
+
+static struct tag_ds28e10 ds28e10_tag;
+
+const struct tag_ds28e10 *hi_ds28e10_boot_tag;
+EXPORT_SYMBOL(hi_ds28e10_boot_tag);
+
+static int __init parse_tag_ds28e10(const struct tag *tag)
+{
+	size_t len = (tag->hdr.size << 2) - sizeof(struct tag_header);
+
+	memcpy(&ds28e10_tag, &tag->u, min(len, sizeof(ds28e10_tag)));
+	hi_ds28e10_boot_tag = &ds28e10_tag;
+
+	return 0;
+}
+
+__tagtable(ATAG_DS28E10, parse_tag_ds28e10);
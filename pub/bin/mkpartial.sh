@@ -0,0 +1,115 @@
+#!/bin/sh
+#
+# Usage: mkpartial.sh <baseline md5> <its> <output its>
+#
+# Copy <its> to <output its>, keeping only the update@ nodes whose image
+# differs from the one recorded in <baseline md5>. The baseline is the
+# images/firmware.md5 generated along with the firmware of a release.
+# The md5s of the images left out go to the baseline node, a device
+# takes the partial firmware only if it has those.
+#
+
+if [ $# -ne 3 ]; then
+	echo "Usage: $0 <baseline md5> <its> <output its>" >&2
+	exit 1
+fi
+
+baseline=$1
+its=$2
+out=$3
+
+files=$(sed -n 's,.*/incbin/("\(.*\)").*,\1,p' $its)
+current=$(md5sum $files) || exit 1
+
+echo "$current" | awk -v baseline=$baseline '
+BEGIN {
+	while ((getline line < baseline) > 0) {
+		split(line, md5, " ")
+		old[md5[2]] = md5[1]
+	}
+}
+{
+	new[$2] = $1
+}
+END {
+	for (f in new)
+		if (old[f] != new[f])
+			print f
+}' > $out.changed
+
+if [ ! -s $out.changed ]; then
+	echo "Nothing changed since the baseline, no firmware generated" >&2
+	rm -f $out.changed
+	exit 1
+fi
+
+echo "Images changed since the baseline:"
+sed 's/^/	/' $out.changed
+
+# The first pass collects the md5 in the baseline of every image left
+# out, by description, for update_check_partial() to compare with what
+# the device has. The second one writes the nodes kept.
+awk -v changed=$out.changed -v baseline=$baseline '
+BEGIN {
+	while ((getline line < changed) > 0)
+		keep[line] = 1
+	while ((getline line < baseline) > 0) {
+		split(line, md5, " ")
+		old[md5[2]] = md5[1]
+	}
+}
+FNR == NR {
+	if ($0 ~ /^\t\tupdate@[0-9]+ {/)
+		desc = file = ""
+	if ($0 ~ /^\t\t\tdescription = /) {
+		desc = $0
+		sub(/.*= "/, "", desc)
+		sub(/".*/, "", desc)
+	}
+	if ($0 ~ /\/incbin\//) {
+		file = $0
+		sub(/.*\/incbin\/\("/, "", file)
+		sub(/"\).*/, "", file)
+	}
+	if ($0 ~ /^\t\t};/ && !(file in keep) && (file in old)) {
+		hex = old[file]
+		gsub(/../, "& ", hex)
+		sub(/ $/, "", hex)
+		base = base "\t\t" desc " = [" hex "];\n"
+	}
+	next
+}
+/^\t\tupdate@[0-9]+ {/ {
+	node = $0 "\n"
+	innode = 1
+	next
+}
+innode {
+	node = node $0 "\n"
+	if ($0 ~ /\/incbin\//) {
+		file = $0
+		sub(/.*\/incbin\/\("/, "", file)
+		sub(/"\).*/, "", file)
+	}
+	if ($0 ~ /^\t\t};/) {
+		if (file in keep)
+			printf "%s", node
+		innode = 0
+	}
+	next
+}
+/^\tdescription = / {
+	print
+	print "\tpartial;"
+	next
+}
+/^\timages {/ {
+	printf "\tbaseline {\n%s\t};\n\n", base
+	print
+	next
+}
+{
+	print
+}' $its $its > $out
+
+rm -f $out.changed
@@ -0,0 +1,305 @@
+/* -- C -- ~ @ ~
+ *
+ * Copyright (c) 2013, Beijing Hanbang Technology, Inc.
+ * John Lee <furious_tauren@163.com>
+ *
+ * All rights reserved. No Part of this file may be reproduced,
+ * stored in a retrieval system, or transmitted, in any form,
+ * or by any means, electronic, mechanical, photocopying, recording,
+ * or otherwise, without the prior consent of HanBang, Inc.
+ */
+
+/*
+ * The host side of generate_secret()/generate_mac() in boot/src/ds28e10.c.
+ * Any change there must be made here as well, the self test of
+ * ds28e10-verify --bench only checks the SIMD lanes against the scalar
+ * code below, not against the device.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ds28e10_mac.h"
+
+void ds28e10_sha1(const uint8_t msg[64], uint32_t sha1[5])
+{
+	int i;
+	uint32_t tmp;
+	uint32_t mt[80];
+	uint32_t ktn[4] = {0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6};
+
+	for (i = 0; i < 16; i++) {
+		mt[i] = (uint32_t)msg[i * 4] << 24
+			| (uint32_t)msg[i * 4 + 1] << 16
+			| (uint32_t)msg[i * 4 + 2] << 8
+			| (uint32_t)msg[i * 4 + 3];
+	}
+
+	for (i = 16; i < 80; i++) {
+		tmp = mt[i - 3] ^ mt[i - 8] ^ mt[i - 14] ^ mt[i - 16];
+		mt[i] = tmp << 1 | tmp >> 31;
+	}
+
+	sha1[0] = 0x67452301;
+	sha1[1] = 0xefcdab89;
+	sha1[2] = 0x98badcfe;
+	sha1[3] = 0x10325476;
+	sha1[4] = 0xc3d2e1f0;
+
+	/* no feed forward, this is what the device does */
+	for (i = 0; i < 80; i++) {
+		tmp = sha1[0] << 5 | sha1[0] >> 27;
+
+		if (i < 20)
+			tmp += (sha1[1] & sha1[2]) | (~sha1[1] & sha1[3]);
+		else if (i < 40)
+			tmp += sha1[1] ^ sha1[2] ^ sha1[3];
+		else if (i < 60)
+			tmp += (sha1[1] & sha1[2])
+				| (sha1[1] & sha1[3]) | (sha1[2] & sha1[3]);
+		else
+			tmp += sha1[1] ^ sha1[2] ^ sha1[3];
+
+		tmp += sha1[4] + ktn[i / 20] + mt[i];
+		sha1[4] = sha1[3];
+		sha1[3] = sha1[2];
+		sha1[2] = sha1[1] << 30 | sha1[1] >> 2;
+		sha1[1] = sha1[0];
+		sha1[0] = tmp;
+	}
+}
+
+void ds28e10_secret_msg(const uint8_t romid[8], uint8_t msg[64])
+{
+	static const uint8_t tmpl[64] = {
+		0x5a, 0xa5, 0xff, 0x00, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+		0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x9e, 0x17, 0xd3, 0x88, 0xff, 0xff, 0xff, 0x80,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xb8
+	};
+
+	memcpy(msg, tmpl, 64);
+	memcpy(msg + 40, romid, 8);
+	msg[40] &= 0x3f;
+}
+
+/* bytes 0 and 2 of the last four words, as generate_secret() */
+void ds28e10_secret_out(const uint32_t sha1[5], uint8_t secret[8])
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		secret[i * 2 + 0] = sha1[4 - i];
+		secret[i * 2 + 1] = sha1[4 - i] >> 16;
+	}
+}
+
+void ds28e10_mac_msg(const struct ds28e10_record *rec,
+		const uint8_t secret[8], uint8_t msg[64])
+{
+	memcpy(msg, secret, 4);
+	memcpy(msg + 4, rec->page, 28);
+	memcpy(msg + 32, rec->challenge + 8, 4);
+	memcpy(msg + 36, rec->challenge, 4);
+	msg[40] = rec->challenge[7];
+	memcpy(msg + 41, rec->romid, 7);
+	memcpy(msg + 48, secret + 4, 4);
+	memcpy(msg + 52, rec->challenge + 4, 3);
+	msg[55] = 0x80;
+	memset(msg + 56, 0, 6);
+	msg[62] = 0x01;
+	msg[63] = 0xb8;
+}
+
+void ds28e10_mac_out(const uint32_t sha1[5], uint8_t mac[20])
+{
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		mac[i * 4 + 0] = sha1[4 - i];
+		mac[i * 4 + 1] = sha1[4 - i] >> 8;
+		mac[i * 4 + 2] = sha1[4 - i] >> 16;
+		mac[i * 4 + 3] = sha1[4 - i] >> 24;
+	}
+}
+
+void ds28e10_secret(const uint8_t romid[8], uint8_t secret[8])
+{
+	uint8_t msg[64];
+	uint32_t sha1[5];
+
+	ds28e10_secret_msg(romid, msg);
+	ds28e10_sha1(msg, sha1);
+	ds28e10_secret_out(sha1, secret);
+}
+
+void ds28e10_mac(const struct ds28e10_record *rec, uint8_t mac[20])
+{
+	uint8_t secret[8];
+	uint8_t msg[64];
+	uint32_t sha1[5];
+
+	ds28e10_secret(rec->romid, secret);
+	ds28e10_mac_msg(rec, secret, msg);
+	ds28e10_sha1(msg, sha1);
+	ds28e10_mac_out(sha1, mac);
+}
+
+/* ---------------------------------------------------------------- */
+/* batches */
+/* ---------------------------------------------------------------- */
+
+static size_t verify_scalar(const struct ds28e10_record *recs, size_t n,
+		int *ok)
+{
+	uint8_t mac[20];
+	size_t i, bad = 0;
+
+	for (i = 0; i < n; i++) {
+		ds28e10_mac(&recs[i], mac);
+		ok[i] = !memcmp(mac, recs[i].mac, 20);
+		bad += !ok[i];
+	}
+	return bad;
+}
+
+#define MAX_LANES	8
+
+/*
+ * lanes records at a time, the tail of the batch is padded by repeating
+ * the last record and the padding results are dropped.
+ */
+static size_t verify_lanes(const struct ds28e10_record *recs, size_t n,
+		int *ok, int lanes)
+{
+	uint8_t msg[MAX_LANES][64];
+	const uint8_t *pmsg[MAX_LANES];
+	uint32_t sha1[MAX_LANES][5];
+	uint8_t secret[8], mac[20];
+	size_t i, bad = 0;
+	int l, cnt;
+
+	for (l = 0; l < lanes; l++)
+		pmsg[l] = msg[l];
+
+	for (i = 0; i < n; i += lanes) {
+		cnt = n - i < (size_t)lanes ? (int)(n - i) : lanes;
+
+		for (l = 0; l < lanes; l++)
+			ds28e10_secret_msg(recs[i + (l < cnt ? l : cnt - 1)].romid,
+					msg[l]);
+		if (lanes == 8)
+			ds28e10_sha1_x8(pmsg, sha1);
+		else
+			ds28e10_sha1_x4(pmsg, sha1);
+
+		for (l = 0; l < lanes; l++) {
+			ds28e10_secret_out(sha1[l], secret);
+			ds28e10_mac_msg(&recs[i + (l < cnt ? l : cnt - 1)],
+					secret, msg[l]);
+		}
+		if (lanes == 8)
+			ds28e10_sha1_x8(pmsg, sha1);
+		else
+			ds28e10_sha1_x4(pmsg, sha1);
+
+		for (l = 0; l < cnt; l++) {
+			ds28e10_mac_out(sha1[l], mac);
+			ok[i + l] = !memcmp(mac, recs[i + l].mac, 20);
+			bad += !ok[i + l];
+		}
+	}
+	return bad;
+}
+
+struct verify_job {
+	const struct ds28e10_record *recs;
+	size_t n;
+	int *ok;
+	enum ds28e10_impl impl;
+	size_t bad;
+	pthread_t thread;
+};
+
+static void *verify_thread(void *arg)
+{
+	struct verify_job *job = arg;
+
+	switch (job->impl) {
+	case DS28E10_AVX2:
+		job->bad = verify_lanes(job->recs, job->n, job->ok, 8);
+		break;
+	case DS28E10_SSE2:
+		job->bad = verify_lanes(job->recs, job->n, job->ok, 4);
+		break;
+	default:
+		job->bad = verify_scalar(job->recs, job->n, job->ok);
+		break;
+	}
+	return NULL;
+}
+
+const char *ds28e10_impl_name(enum ds28e10_impl impl)
+{
+	static const char *names[] = {"auto", "scalar", "sse2", "avx2"};
+
+	return names[impl];
+}
+
+#define MAX_THREADS	64
+
+size_t ds28e10_verify(const struct ds28e10_record *recs, size_t n, int *ok,
+		enum ds28e10_impl impl, int threads)
+{
+	struct verify_job job[MAX_THREADS];
+	size_t per, off, bad = 0;
+	int t;
+
+	if (impl == DS28E10_AUTO)
+		impl = ds28e10_have_avx2() ? DS28E10_AVX2 : DS28E10_SSE2;
+	if (impl == DS28E10_AVX2 && !ds28e10_have_avx2())
+		impl = DS28E10_SSE2;
+
+	/* a record no job gets must not pass */
+	memset(ok, 0, n * sizeof(*ok));
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+	if ((size_t)threads > n / 64 + 1)	/* not worth a thread */
+		threads = n / 64 + 1;
+
+	/* multiples of 8 records per thread, no lane is wasted but the last */
+	per = ((n + threads - 1) / threads + 7) & ~(size_t)7;
+
+	for (t = 0, off = 0; t < threads && off < n; t++, off += per) {
+		job[t].recs = recs + off;
+		job[t].n = n - off < per ? n - off : per;
+		job[t].ok = ok + off;
+		job[t].impl = impl;
+		job[t].thread = pthread_self();
+		if (t && pthread_create(&job[t].thread, NULL,
+					verify_thread, &job[t])) {
+			job[t].thread = pthread_self();
+			verify_thread(&job[t]);	/* do it here then */
+		}
+	}
+	threads = t;
+
+	/* the caller is the first worker */
+	if (threads)
+		verify_thread(&job[0]);
+
+	for (t = 0; t < threads; t++) {
+		if (t && !pthread_equal(job[t].thread, pthread_self()))
+			pthread_join(job[t].thread, NULL);
+		bad += job[t].bad;
+	}
+	return bad;
+}
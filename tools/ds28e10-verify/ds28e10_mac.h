@@ -0,0 +1,59 @@
+/* -- C -- ~ @ ~
+ *
+ * Copyright (c) 2013, Beijing Hanbang Technology, Inc.
+ * John Lee <furious_tauren@163.com>
+ *
+ * All rights reserved. No Part of this file may be reproduced,
+ * stored in a retrieval system, or transmitted, in any form,
+ * or by any means, electronic, mechanical, photocopying, recording,
+ * or otherwise, without the prior consent of HanBang, Inc.
+ */
+
+#ifndef __DS28E10_MAC_H__
+#define __DS28E10_MAC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* what a camera reports, as read by authenticate() in boot/src/ds28e10.c */
+struct ds28e10_record {
+	uint8_t romid[8];
+	uint8_t challenge[12];
+	uint8_t page[28];
+	uint8_t mac[20];
+};
+
+enum ds28e10_impl {
+	DS28E10_AUTO,
+	DS28E10_SCALAR,
+	DS28E10_SSE2,		/* 4 records at a time */
+	DS28E10_AVX2,		/* 8 records at a time */
+};
+
+/* the routines of boot/src/ds28e10.c, bit for bit */
+void ds28e10_sha1(const uint8_t msg[64], uint32_t sha1[5]);
+void ds28e10_secret(const uint8_t romid[8], uint8_t secret[8]);
+void ds28e10_mac(const struct ds28e10_record *rec, uint8_t mac[20]);
+
+/* the two 64-byte blocks of one record */
+void ds28e10_secret_msg(const uint8_t romid[8], uint8_t msg[64]);
+void ds28e10_secret_out(const uint32_t sha1[5], uint8_t secret[8]);
+void ds28e10_mac_msg(const struct ds28e10_record *rec,
+		const uint8_t secret[8], uint8_t msg[64]);
+void ds28e10_mac_out(const uint32_t sha1[5], uint8_t mac[20]);
+
+/* n single-block SHA-1 at once, n is 4 for SSE2 and 8 for AVX2 */
+void ds28e10_sha1_x4(const uint8_t *msg[4], uint32_t sha1[4][5]);
+void ds28e10_sha1_x8(const uint8_t *msg[8], uint32_t sha1[8][5]);
+int ds28e10_have_avx2(void);
+
+/*
+ * ok[i] is set to 1 when the MAC of recs[i] is right, 0 otherwise.
+ * threads <= 0 uses one thread per CPU. Returns the number of bad ones.
+ */
+size_t ds28e10_verify(const struct ds28e10_record *recs, size_t n, int *ok,
+		enum ds28e10_impl impl, int threads);
+
+const char *ds28e10_impl_name(enum ds28e10_impl impl);
+
+#endif
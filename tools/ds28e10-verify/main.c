@@ -0,0 +1,322 @@
+/* -- C -- ~ @ ~
+ *
+ * Copyright (c) 2013, Beijing Hanbang Technology, Inc.
+ * John Lee <furious_tauren@163.com>
+ *
+ * All rights reserved. No Part of this file may be reproduced,
+ * stored in a retrieval system, or transmitted, in any form,
+ * or by any means, electronic, mechanical, photocopying, recording,
+ * or otherwise, without the prior consent of HanBang, Inc.
+ */
+
+/*
+ * ds28e10-verify [-j threads] [-i auto|scalar|sse2|avx2] [file]
+ * ds28e10-verify --bench [count]
+ * ds28e10-verify --test
+ *
+ * Each line of the input is one record, four hex strings separated by
+ * blanks: romid (8 bytes), challenge (12), page (28) and mac (20), as
+ * returned by IOCTL_AUTHENTICATE. Empty lines and lines starting with #
+ * are skipped. The bad records are printed with their line numbers, the
+ * exit status is 1 if there is any.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "ds28e10_mac.h"
+
+struct input {
+	struct ds28e10_record *recs;
+	unsigned long *lines;
+	size_t n, size;
+};
+
+static int parse_hex(const char **s, uint8_t *buf, int len)
+{
+	const char *p = *s;
+	int i;
+
+	while (isspace((unsigned char)*p))
+		p++;
+
+	for (i = 0; i < len * 2; i++) {
+		int c = tolower((unsigned char)p[i]);
+		int v;
+
+		if (c >= '0' && c <= '9')
+			v = c - '0';
+		else if (c >= 'a' && c <= 'f')
+			v = c - 'a' + 10;
+		else
+			return -1;
+
+		if (i & 1)
+			buf[i / 2] |= v;
+		else
+			buf[i / 2] = v << 4;
+	}
+
+	if (p[i] && !isspace((unsigned char)p[i]))
+		return -1;
+
+	*s = p + i;
+	return 0;
+}
+
+static int read_input(FILE *fp, struct input *in)
+{
+	char line[512];
+	unsigned long lineno = 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		struct ds28e10_record rec;
+		const char *p = line;
+
+		lineno++;
+		while (isspace((unsigned char)*p))
+			p++;
+		if (!*p || *p == '#')
+			continue;
+
+		if (parse_hex(&p, rec.romid, 8)
+				|| parse_hex(&p, rec.challenge, 12)
+				|| parse_hex(&p, rec.page, 28)
+				|| parse_hex(&p, rec.mac, 20)) {
+			fprintf(stderr, "line %lu: bad record\n", lineno);
+			return -1;
+		}
+
+		if (in->n == in->size) {
+			in->size = in->size ? in->size * 2 : 1024;
+			in->recs = realloc(in->recs,
+					in->size * sizeof(*in->recs));
+			in->lines = realloc(in->lines,
+					in->size * sizeof(*in->lines));
+			if (!in->recs || !in->lines) {
+				fprintf(stderr, "out of memory\n");
+				return -1;
+			}
+		}
+		in->lines[in->n] = lineno;
+		in->recs[in->n++] = rec;
+	}
+
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* random records with right MACs, those with (i % broken == broken - 1) not */
+static struct ds28e10_record *make_records(size_t n, size_t broken)
+{
+	struct ds28e10_record *recs;
+	size_t i, j;
+
+	recs = malloc(n * sizeof(*recs));
+	if (!recs)
+		return NULL;
+
+	for (i = 0; i < n; i++) {
+		uint8_t *p = (uint8_t *)&recs[i];
+
+		for (j = 0; j < sizeof(recs[i]); j++)
+			p[j] = rand();
+		ds28e10_mac(&recs[i], recs[i].mac);
+		if (i % broken == broken - 1)
+			recs[i].mac[i % 20] ^= 1 << (i % 8);
+	}
+
+	return recs;
+}
+
+/*
+ * Every record must be verified whatever the split between threads and
+ * lanes, the counts are chosen not to be multiples of threads * 8.
+ */
+static int selftest(void)
+{
+	static const size_t counts[] = {1, 7, 9, 63, 194, 1001, 4099};
+	static const int threads[] = {1, 2, 3, 4, 5, 7, 16};
+	static const enum ds28e10_impl impls[] = {
+		DS28E10_SCALAR, DS28E10_SSE2, DS28E10_AVX2
+	};
+	size_t c, i, want, bad, fails = 0;
+	int t, m;
+
+	srand(2);
+	for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		size_t n = counts[c];
+		struct ds28e10_record *recs = make_records(n, 5);
+		int *ok = malloc(n * sizeof(*ok));
+
+		if (!recs || !ok) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+		want = n / 5;
+
+		for (m = 0; m < 3; m++) {
+			if (impls[m] == DS28E10_AVX2 && !ds28e10_have_avx2())
+				continue;
+
+			for (t = 0; t < (int)(sizeof(threads) /
+						sizeof(threads[0])); t++) {
+				/* left over from the last run, must not count */
+				for (i = 0; i < n; i++)
+					ok[i] = 1;
+
+				bad = ds28e10_verify(recs, n, ok, impls[m],
+						threads[t]);
+				for (i = 0; i < n; i++)
+					if (ok[i] != (i % 5 != 4))
+						break;
+				if (bad != want || i != n) {
+					printf("FAIL %s n=%lu threads=%d"
+						" record %lu\n",
+						ds28e10_impl_name(impls[m]),
+						(unsigned long)n, threads[t],
+						(unsigned long)i);
+					fails++;
+				}
+			}
+		}
+
+		free(recs);
+		free(ok);
+	}
+
+	printf("%s\n", fails ? "FAILED" : "ok");
+	return fails ? 1 : 0;
+}
+
+/* random records with right MACs, every 97th one is broken */
+static int bench(size_t n)
+{
+	static const enum ds28e10_impl impls[] = {
+		DS28E10_SCALAR, DS28E10_SSE2, DS28E10_AVX2
+	};
+	struct ds28e10_record *recs;
+	int *ok;
+	size_t i, j, bad, want = n / 97;
+	int rval = 0;
+
+	srand(1);
+	recs = make_records(n, 97);
+	ok = malloc(n * sizeof(*ok));
+	if (!recs || !ok) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		int threads;
+
+		if (impls[i] == DS28E10_AVX2 && !ds28e10_have_avx2()) {
+			printf("%-6s not supported by this CPU\n",
+					ds28e10_impl_name(impls[i]));
+			continue;
+		}
+
+		for (threads = 1; threads >= 0; threads--) {
+			double t = now();
+
+			bad = ds28e10_verify(recs, n, ok, impls[i], threads);
+			t = now() - t;
+
+			printf("%-6s %-4s %10.0f records/s\n",
+					ds28e10_impl_name(impls[i]),
+					threads ? "1T" : "MT", n / t);
+
+			/* the lanes must agree with the scalar code */
+			for (j = 0; j < n; j++)
+				if (ok[j] != (j % 97 != 96))
+					break;
+			if (bad != want || j != n) {
+				printf("%-6s MISMATCH at record %lu\n",
+						ds28e10_impl_name(impls[i]),
+						(unsigned long)j);
+				rval = 1;
+			}
+		}
+	}
+
+	free(recs);
+	free(ok);
+	return rval;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: ds28e10-verify [-j threads] [-i auto|scalar|sse2|avx2]"
+		" [file]\n"
+		"       ds28e10-verify --bench [count]\n"
+		"       ds28e10-verify --test\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	enum ds28e10_impl impl = DS28E10_AUTO;
+	struct input in = {0};
+	FILE *fp = stdin;
+	int threads = 0;
+	size_t i, bad;
+	int *ok;
+	int c;
+
+	for (c = 1; c < argc && argv[c][0] == '-' && argv[c][1]; c++) {
+		if (!strcmp(argv[c], "--test"))
+			return selftest();
+		else if (!strcmp(argv[c], "--bench"))
+			return bench(c + 1 < argc ? strtoul(argv[c + 1], NULL, 0)
+					: 1000000);
+		else if (!strcmp(argv[c], "-j") && c + 1 < argc)
+			threads = atoi(argv[++c]);
+		else if (!strcmp(argv[c], "-i") && c + 1 < argc) {
+			c++;
+			for (impl = DS28E10_AUTO; impl <= DS28E10_AVX2; impl++)
+				if (!strcmp(argv[c], ds28e10_impl_name(impl)))
+					break;
+			if (impl > DS28E10_AVX2)
+				usage();
+		} else
+			usage();
+	}
+
+	if (c < argc) {
+		fp = fopen(argv[c], "r");
+		if (!fp) {
+			perror(argv[c]);
+			return 2;
+		}
+	}
+
+	if (read_input(fp, &in))
+		return 2;
+
+	ok = malloc((in.n + 1) * sizeof(*ok));
+	if (!ok) {
+		fprintf(stderr, "out of memory\n");
+		return 2;
+	}
+
+	bad = ds28e10_verify(in.recs, in.n, ok, impl, threads);
+	for (i = 0; i < in.n; i++)
+		if (!ok[i])
+			printf("line %lu: bad mac\n", in.lines[i]);
+
+	printf("%lu records, %lu bad\n", (unsigned long)in.n,
+			(unsigned long)bad);
+	return bad ? 1 : 0;
+}
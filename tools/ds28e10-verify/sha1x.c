@@ -0,0 +1,131 @@
+/* -- C -- ~ @ ~
+ *
+ * Copyright (c) 2013, Beijing Hanbang Technology, Inc.
+ * John Lee <furious_tauren@163.com>
+ *
+ * All rights reserved. No Part of this file may be reproduced,
+ * stored in a retrieval system, or transmitted, in any form,
+ * or by any means, electronic, mechanical, photocopying, recording,
+ * or otherwise, without the prior consent of HanBang, Inc.
+ */
+
+/*
+ * Multi-buffer ds28e10_sha1(): one record per 32-bit lane, 4 lanes in
+ * SSE2 and 8 in AVX2. The rounds are those of ds28e10_sha1(), including
+ * the missing feed forward of the state.
+ */
+
+#include <immintrin.h>
+
+#include "ds28e10_mac.h"
+
+static const uint32_t ktn[4] = {0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6};
+static const uint32_t iv[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+static inline uint32_t load_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16
+		| (uint32_t)p[2] << 8 | p[3];
+}
+
+/*
+ * V is the vector type, S the intrinsic prefix and LANES its width.
+ * The message schedule is computed on the fly in a ring of 16 words.
+ */
+#define SHA1_LANES(name, V, S, LANES, ATTR)				\
+ATTR void name(const uint8_t *msg[LANES], uint32_t sha1[LANES][5])	\
+{									\
+	uint32_t w[16][LANES] __attribute__((aligned(32)));		\
+	uint32_t out[5][LANES] __attribute__((aligned(32)));		\
+	V mt[16], a, b, c, d, e, f, t, k;				\
+	int i, l;							\
+									\
+	for (i = 0; i < 16; i++)					\
+		for (l = 0; l < LANES; l++)				\
+			w[i][l] = load_be32(msg[l] + i * 4);		\
+	for (i = 0; i < 16; i++)					\
+		mt[i] = S##_load_si##LANES##x(w[i]);			\
+									\
+	a = S##_set1_epi32(iv[0]);					\
+	b = S##_set1_epi32(iv[1]);					\
+	c = S##_set1_epi32(iv[2]);					\
+	d = S##_set1_epi32(iv[3]);					\
+	e = S##_set1_epi32(iv[4]);					\
+									\
+	for (i = 0; i < 80; i++) {					\
+		if (i >= 16) {						\
+			t = S##_xor_si##LANES##x(			\
+				S##_xor_si##LANES##x(mt[(i - 3) & 15],	\
+					mt[(i - 8) & 15]),		\
+				S##_xor_si##LANES##x(mt[(i - 14) & 15],	\
+					mt[i & 15]));			\
+			mt[i & 15] = S##_or_si##LANES##x(		\
+				S##_slli_epi32(t, 1),			\
+				S##_srli_epi32(t, 31));			\
+		}							\
+									\
+		if (i < 20)						\
+			f = S##_or_si##LANES##x(			\
+				S##_and_si##LANES##x(b, c),		\
+				S##_andnot_si##LANES##x(b, d));		\
+		else if (i < 60 && i >= 40)				\
+			f = S##_or_si##LANES##x(			\
+				S##_or_si##LANES##x(			\
+					S##_and_si##LANES##x(b, c),	\
+					S##_and_si##LANES##x(b, d)),	\
+				S##_and_si##LANES##x(c, d));		\
+		else							\
+			f = S##_xor_si##LANES##x(			\
+				S##_xor_si##LANES##x(b, c), d);		\
+									\
+		k = S##_set1_epi32(ktn[i / 20]);			\
+		t = S##_or_si##LANES##x(S##_slli_epi32(a, 5),		\
+				S##_srli_epi32(a, 27));			\
+		t = S##_add_epi32(t, f);				\
+		t = S##_add_epi32(t, e);				\
+		t = S##_add_epi32(t, k);				\
+		t = S##_add_epi32(t, mt[i & 15]);			\
+		e = d;							\
+		d = c;							\
+		c = S##_or_si##LANES##x(S##_slli_epi32(b, 30),		\
+				S##_srli_epi32(b, 2));			\
+		b = a;							\
+		a = t;							\
+	}								\
+									\
+	S##_store_si##LANES##x(out[0], a);				\
+	S##_store_si##LANES##x(out[1], b);				\
+	S##_store_si##LANES##x(out[2], c);				\
+	S##_store_si##LANES##x(out[3], d);				\
+	S##_store_si##LANES##x(out[4], e);				\
+	for (l = 0; l < LANES; l++)					\
+		for (i = 0; i < 5; i++)					\
+			sha1[l][i] = out[i][l];				\
+}
+
+/* the names of the 128 and 256 bit integer intrinsics differ a bit */
+#define _mm_load_si4x(p)		_mm_load_si128((const __m128i *)(p))
+#define _mm_store_si4x(p, v)		_mm_store_si128((__m128i *)(p), v)
+#define _mm_xor_si4x			_mm_xor_si128
+#define _mm_or_si4x			_mm_or_si128
+#define _mm_and_si4x			_mm_and_si128
+#define _mm_andnot_si4x			_mm_andnot_si128
+
+#define _mm256_load_si8x(p)		_mm256_load_si256((const __m256i *)(p))
+#define _mm256_store_si8x(p, v)		_mm256_store_si256((__m256i *)(p), v)
+#define _mm256_xor_si8x			_mm256_xor_si256
+#define _mm256_or_si8x			_mm256_or_si256
+#define _mm256_and_si8x			_mm256_and_si256
+#define _mm256_andnot_si8x		_mm256_andnot_si256
+
+SHA1_LANES(ds28e10_sha1_x4, __m128i, _mm, 4, )
+SHA1_LANES(ds28e10_sha1_x8, __m256i, _mm256, 8,
+		__attribute__((target("avx2"))))
+
+int ds28e10_have_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}